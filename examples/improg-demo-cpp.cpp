@@ -0,0 +1,100 @@
+#include "improg/improg.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+
+using file_row = imp::composite<-1,
+  imp::label<"Copying : ">,
+  imp::string_custom_trim<20, 20, "…", true>,
+  imp::label<" ">,
+  imp::progress_bar<-1, "[", "]", "=", " ", imp::label<">">>,
+  imp::label<" ">,
+  imp::progress_fraction<-1, 1, IMP_UNIT_SIZE_DYNAMIC>,
+  imp::label<" ">,
+  imp::progress_percent<7, 2>>;
+
+using spin_row = imp::composite<-1,
+  imp::label<"Waiting : ">,
+  imp::spinner<100, "⠋", "⠙", "⠹", "⠸", "⠼", "⠴", "⠦", "⠧", "⠇", "⠏">,
+  imp::label<" elapsed=">,
+  imp::scalar<-1, 2, IMP_UNIT_TIME_SEC>>;
+
+using block_row = imp::composite<-1,
+  imp::label<"Blocks  : ">,
+  imp::progress_bar_scale_edge_fill<40, "[", "]", "█", " ",
+    imp::progress_label<-1,
+      imp::progress_label_entry<1, 8, " ">,
+      imp::progress_label_entry<2, 8, "▏">,
+      imp::progress_label_entry<3, 8, "▎">,
+      imp::progress_label_entry<4, 8, "▍">,
+      imp::progress_label_entry<5, 8, "▌">,
+      imp::progress_label_entry<6, 8, "▋">,
+      imp::progress_label_entry<7, 8, "▊">,
+      imp::progress_label_entry<8, 8, "█">>>>;
+
+using batch_row = imp::composite<-1,
+  imp::label<"Batch   : ">,
+  imp::stacked_bar<-1, "[", "]", " ",
+    imp::stacked_bar_segment<IMP_COLOR_FG_GREEN, "█">,
+    imp::stacked_bar_segment<IMP_COLOR_FG_RED, "█">,
+    imp::stacked_bar_segment<"", "░">>>;
+
+using rate_row = imp::composite<-1,
+  imp::label<"Rate    : ">,
+  imp::sparkline<24>,
+  imp::label<" ">,
+  imp::scalar<9, 1, IMP_UNIT_SIZE_DYNAMIC>,
+  imp::label<"/s">>;
+
+void verify(imp_ret_t ret) {
+  if (ret != IMP_RET_SUCCESS) { std::printf("error\n"); std::exit(1); }
+}
+
+}  // namespace
+
+int main() {
+  imp_util_enable_utf8();
+  imp::ctx ctx;
+
+  using clock = std::chrono::steady_clock;
+  auto const start = clock::now();
+  int64_t const total_bytes = 48LL * 1024 * 1024;
+  imp_history_slot_t rate_slots[32];
+  imp_history_t rate_history;
+  verify(imp_history_init(&rate_history, rate_slots, 32));
+  int64_t last_bytes = 0;
+
+  bool done = false;
+  do {
+    double elapsed_s = std::chrono::duration<double>(clock::now() - start).count();
+    done = elapsed_s >= 5.;
+    if (done) { elapsed_s = 5.; }
+
+    uint16_t term_width = 50;
+    imp_util_get_terminal_width(&term_width);
+
+    auto const bytes = static_cast<int64_t>(elapsed_s / 5. * static_cast<double>(total_bytes));
+    verify(ctx.begin(term_width));
+    verify(ctx.draw_line<file_row>(imp::progress(bytes, total_bytes),
+                                   "/usr/share/dict/very/deep/path/to/words.txt"));
+    verify(ctx.draw_line<spin_row>(static_cast<int>(elapsed_s * 1000.), elapsed_s));
+    verify(ctx.draw_line<block_row>(imp::progress(elapsed_s, 5.)));
+    int64_t const rate = (bytes - last_bytes) * 60; // ~60 frames per second
+    last_bytes = bytes;
+    imp_history_push(&rate_history, rate);
+    verify(ctx.draw_line<rate_row>(&rate_history, rate));
+    int const jobs = static_cast<int>(elapsed_s * 20.), failed = jobs / 7;
+    int const in_flight = (jobs < 100) ? (jobs - failed < 5 ? jobs - failed : 5) : 0;
+    verify(ctx.draw_line<batch_row>(imp::progress(jobs, 100), jobs - failed - in_flight, failed,
+                                    in_flight));
+    verify(ctx.end(done));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(16));
+  } while (!done);
+
+  return 0;
+}
@@ -1,4 +1,5 @@
 #include "improg/improg.h"
+#include "improg/imprec.h"
 
 #ifdef _WIN32
 #pragma warning(push)
@@ -13,6 +14,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #ifdef _WIN32
@@ -734,6 +736,62 @@ static void test_progress_bar(imp_ctx_t *ctx, double elapsed_s) {
   }
 }
 
+static void test_stacked_bar(imp_ctx_t *ctx, double elapsed_s) {
+  // A batch of 400 jobs: done, failed and in flight, with the rest queued.
+  int const started = (int)(elapsed_s * 40.);
+  int const failed = started / 9;
+  int const unfinished = started - failed;
+  int const in_flight = (started < 400) ? ((unfinished < 12) ? unfinished : 12) : 0;
+  int const done = unfinished - in_flight;
+
+  imp_widget_def_t const w = IMP_WIDGET_COMPOSITE(-1, 3, IMP_ARRAY(
+    IMP_WIDGET_LABEL("S-Bar   : "),
+    IMP_WIDGET_STACKED_BAR(-1, "[", "]", ".", 3, IMP_ARRAY(
+      IMP_WIDGET_STACKED_BAR_SEGMENT(IMP_COLOR_FG_GREEN, "#"),
+      IMP_WIDGET_STACKED_BAR_SEGMENT(IMP_COLOR_FG_RED, "x"),
+      IMP_WIDGET_STACKED_BAR_SEGMENT(NULL, "~"))),
+    IMP_WIDGET_PROGRESS_FRACTION(10, -1, IMP_UNIT_NONE)));
+
+  imp_value_t const v = IMP_VALUE_COMPOSITE(3, IMP_ARRAY(
+    IMP_VALUE_NULL(),
+    IMP_VALUE_COMPOSITE(3, IMP_ARRAY(
+      IMP_VALUE_INT(done), IMP_VALUE_INT(failed), IMP_VALUE_INT(in_flight))),
+    IMP_VALUE_NULL()));
+
+  VERIFY_IMP(imp_draw_line(
+    ctx, &(imp_value_t)IMP_VALUE_INT(done + failed), &(imp_value_t)IMP_VALUE_INT(400), &w, &v));
+}
+
+static void test_sparkline(imp_ctx_t *ctx, double elapsed_s) {
+  // A transfer rate sampled every 100ms, stalling for a second and a half midway.
+  static imp_history_slot_t s_slots[32];
+  static imp_history_t s_history;
+  static int s_samples;
+  if (!s_history.slots) { VERIFY_IMP(imp_history_init(&s_history, s_slots, 32)); }
+
+  bool const stalled = (elapsed_s >= 4.) && (elapsed_s < 5.5);
+  int64_t const rate = stalled ? 0 : (int64_t)(3e6 + (2e6 * sin(elapsed_s * 3.)));
+  for (; s_samples <= (int)(elapsed_s * 10.); ++s_samples) {
+    imp_history_push(&s_history, rate);
+  }
+
+  imp_widget_def_t const w = IMP_WIDGET_COMPOSITE(-1, 5, IMP_ARRAY(
+    IMP_WIDGET_LABEL("Rate    : "),
+    IMP_WIDGET_SPARKLINE(-1),
+    IMP_WIDGET_LABEL(" "),
+    IMP_WIDGET_SCALAR_UNIT(9, 1, IMP_UNIT_SIZE_DYNAMIC),
+    IMP_WIDGET_LABEL("/s")));
+
+  imp_value_t const v = IMP_VALUE_COMPOSITE(5, IMP_ARRAY(
+    IMP_VALUE_NULL(),
+    IMP_VALUE_HISTORY(&s_history),
+    IMP_VALUE_NULL(),
+    IMP_VALUE_INT(rate),
+    IMP_VALUE_NULL()));
+
+  VERIFY_IMP(imp_draw_line(ctx, NULL, NULL, &w, &v));
+}
+
 static void test_add_and_remove_lines(imp_ctx_t *ctx, double elapsed_s) {
   imp_widget_def_t const w = IMP_WIDGET_COMPOSITE(-1, 2, IMP_ARRAY(
     IMP_WIDGET_LABEL("Add/Rem : "), IMP_WIDGET_SCALAR(-1, -1)));
@@ -741,21 +799,46 @@ static void test_add_and_remove_lines(imp_ctx_t *ctx, double elapsed_s) {
   imp_value_t const cur_prog = IMP_VALUE_DOUBLE(elapsed_s * 100000.);
   imp_value_t const max_prog = IMP_VALUE_DOUBLE(10. * 100000.);
 
+  enum { MAX_LINES = 6 };
+  imp_value_t cur_progs[MAX_LINES], max_progs[MAX_LINES], vals[MAX_LINES][2];
+  imp_value_t cvs[MAX_LINES];
+  imp_widget_def_t const *ws[MAX_LINES];
+  imp_value_t const *vs[MAX_LINES];
+
   int const si = (int)elapsed_s, lines = 1 + (si < 6 ? si : -(si - 10));
   for (int i = 0; i < lines; ++i) {
-    imp_value_t const v =
-      IMP_VALUE_COMPOSITE(2, IMP_ARRAY(IMP_VALUE_NULL(), IMP_VALUE_INT(i)));
-
-    VERIFY_IMP(imp_draw_line(ctx, &cur_prog, &max_prog, &w, &v));
+    vals[i][0] = (imp_value_t)IMP_VALUE_NULL();
+    vals[i][1] = (imp_value_t)IMP_VALUE_INT(i);
+    cvs[i] = (imp_value_t){ .type = IMP_VALUE_TYPE_COMPOSITE,
+                            .v = { .c = { .value_count = 2, .values = vals[i] } } };
+    cur_progs[i] = cur_prog;
+    max_progs[i] = max_prog;
+    ws[i] = &w;
+    vs[i] = &cvs[i];
   }
+
+  VERIFY_IMP(imp_draw_lines(ctx, lines, cur_progs, max_progs, ws, vs));
+}
+
+static void stdout_print_cb(void *ctx, char const *s) {
+  (void)ctx; s ? (void)fputs(s, stdout) : (void)fflush(stdout);
 }
 
-static void test_improg(void) {
+static void test_improg(char const *record_path) {
   imp_util_enable_utf8();
 
   imp_ctx_t ctx;
   VERIFY_IMP(imp_init(&ctx, NULL, NULL));
 
+  static char rec_buf[16384];
+  imprec_t rec;
+  FILE *rec_f = record_path ? fopen(record_path, "wb") : NULL;
+  if (record_path && !rec_f) { printf("unable to open %s\n", record_path); exit(1); }
+  if (rec_f) {
+    VERIFY_IMP(imprec_init(&rec, rec_f, rec_buf, sizeof(rec_buf), stdout_print_cb, NULL));
+    VERIFY_IMP(imp_init(&ctx, imprec_print_cb, &rec));
+  }
+
   struct timespec start;
   timespec_get(&start, TIME_UTC);
 
@@ -791,16 +874,20 @@ static void test_improg(void) {
     test_progress_scalar_float(&ctx, elapsed_s);
     test_progress_fraction_int(&ctx, elapsed_s);
     test_progress_bar(&ctx, elapsed_s);
+    test_stacked_bar(&ctx, elapsed_s);
+    test_sparkline(&ctx, elapsed_s);
     test_add_and_remove_lines(&ctx, elapsed_s);
     test_label(&ctx);
     VERIFY_IMP(imp_end(&ctx, done));
 
     msleep(frame_time_ms);
   } while (!done);
+
+  if (rec_f) { fclose(rec_f); }
 }
 
 int main(int argc, char const *argv[]) {
-  (void)argc; (void)argv;
-  test_improg();
+  bool const record = (argc == 3) && !strcmp(argv[1], "--record");
+  test_improg(record ? argv[2] : NULL);
   return 0;
 }
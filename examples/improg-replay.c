@@ -0,0 +1,88 @@
+// Replays an ImpRec recording (e.g. from `improg-demo --record FILE`) as fast as possible,
+// then reports throughput on stderr. --null discards output to time the replay alone; --vt
+// renders into a headless terminal instead and also reports how many cells changed.
+#include "improg/imprec.h"
+#include "improg/impvt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void stdout_print_cb(void *ctx, char const *s) {
+  (void)ctx; s ? (void)fputs(s, stdout) : (void)fflush(stdout);
+}
+
+static void null_print_cb(void *ctx, char const *s) { (void)ctx; (void)s; }
+
+static char *read_file(char const *path, size_t *out_len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) { return NULL; }
+  char *data = NULL;
+  size_t len = 0, cap = 0;
+  for (;;) {
+    if (len == cap) {
+      cap = cap ? (cap * 2) : 65536;
+      char *grown = (char *)realloc(data, cap);
+      if (!grown) { free(data); fclose(f); return NULL; }
+      data = grown;
+    }
+    size_t const n = fread(&data[len], 1, cap - len, f);
+    if (!n) { break; }
+    len += n;
+  }
+  fclose(f);
+  *out_len = len;
+  return data;
+}
+
+int main(int argc, char const *argv[]) {
+  char const *path = NULL;
+  bool null_sink = false, vt_sink = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--null")) {
+      null_sink = true;
+    } else if (!strcmp(argv[i], "--vt")) {
+      vt_sink = true;
+    } else {
+      path = argv[i];
+    }
+  }
+  if (!path) {
+    fprintf(stderr, "usage: %s [--null | --vt] recording.imprec\n", argv[0]);
+    return 1;
+  }
+
+  size_t len = 0;
+  char *data = read_file(path, &len);
+  if (!data) { fprintf(stderr, "unable to read %s\n", path); return 1; }
+
+  enum { VT_ROWS = 64, VT_COLS = 256 };
+  static impvt_cell_t s_vt_cells[VT_ROWS * VT_COLS];
+  impvt_t vt;
+  impvt_init(&vt, s_vt_cells, VT_ROWS, VT_COLS);
+
+  imp_print_cb_t const print_cb =
+    vt_sink ? impvt_print_cb : null_sink ? null_print_cb : stdout_print_cb;
+
+  struct timespec start, end;
+  timespec_get(&start, TIME_UTC);
+  imprec_stats_t stats;
+  imp_ret_t const ret = imprec_replay(data, len, print_cb, vt_sink ? &vt : NULL, &stats);
+  timespec_get(&end, TIME_UTC);
+  free(data);
+
+  if (ret != IMP_RET_SUCCESS) { fprintf(stderr, "malformed recording %s\n", path); return 1; }
+
+  double const sec = (double)(end.tv_sec - start.tv_sec) + (1e-9 * (double)(end.tv_nsec - start.tv_nsec));
+  fprintf(stderr, "%u frames, %llu bytes in %.6fs (%.1f frames/s, %.2f MB/s)\n",
+    (unsigned)stats.frame_count, (unsigned long long)stats.byte_count, sec,
+    sec > 0. ? (double)stats.frame_count / sec : 0.,
+    sec > 0. ? (double)stats.byte_count / sec / (1024. * 1024.) : 0.);
+  if (vt_sink) {
+    fprintf(stderr, "%llu cells changed, %.2f bytes per changed cell\n",
+      (unsigned long long)vt.cells_changed,
+      vt.cells_changed ? (double)vt.bytes_fed / (double)vt.cells_changed : 0.);
+  }
+  return 0;
+}
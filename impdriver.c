@@ -0,0 +1,104 @@
+#include "improg/impdriver.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t impdrv__now_nsec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t impdrv__drain(int fd) {
+  uint64_t n = 0;
+  ssize_t r;
+  do { r = read(fd, &n, sizeof(n)); } while ((r < 0) && (errno == EINTR));
+  return (r == (ssize_t)sizeof(n)) ? n : 0;
+}
+
+static imp_ret_t impdrv__arm(impdrv_t *drv, uint64_t delay_nsec) {
+  if (!delay_nsec) { delay_nsec = 1; } // all-zero it_value disarms
+  struct itimerspec const its = {
+    .it_interval = { .tv_sec = 0, .tv_nsec = 0 },
+    .it_value = { .tv_sec = (time_t)(delay_nsec / 1000000000ull),
+                  .tv_nsec = (long)(delay_nsec % 1000000000ull) },
+  };
+  if (timerfd_settime(drv->timer_fd, 0, &its, NULL)) { return IMP_RET_ERR_SYSTEM; }
+  drv->timer_armed = true;
+  return IMP_RET_SUCCESS;
+}
+
+static bool impdrv__open(impdrv_t *drv) {
+  drv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  drv->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  drv->dirty_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ((drv->epoll_fd < 0) || (drv->timer_fd < 0) || (drv->dirty_fd < 0)) { return false; }
+
+  struct epoll_event ev = { .events = EPOLLIN };
+  ev.data.fd = drv->timer_fd;
+  if (epoll_ctl(drv->epoll_fd, EPOLL_CTL_ADD, drv->timer_fd, &ev)) { return false; }
+  ev.data.fd = drv->dirty_fd;
+  return !epoll_ctl(drv->epoll_fd, EPOLL_CTL_ADD, drv->dirty_fd, &ev);
+}
+
+imp_ret_t impdrv_init(impdrv_t *drv,
+                      imp_ctx_t *ctx,
+                      unsigned frame_msec,
+                      impdrv_render_cb_t render_cb,
+                      void *render_cb_ctx) {
+  if (!drv || !ctx || !render_cb) { return IMP_RET_ERR_ARGS; }
+  *drv = (impdrv_t){ .ctx = ctx, .render_cb = render_cb, .render_cb_ctx = render_cb_ctx,
+    .frame_msec = frame_msec, .epoll_fd = -1, .timer_fd = -1, .dirty_fd = -1 };
+
+  if (!impdrv__open(drv)) {
+    impdrv_destroy(drv);
+    return IMP_RET_ERR_SYSTEM;
+  }
+  return IMP_RET_SUCCESS;
+}
+
+void impdrv_destroy(impdrv_t *drv) {
+  if (!drv) { return; }
+  if (drv->epoll_fd >= 0) { close(drv->epoll_fd); }
+  if (drv->timer_fd >= 0) { close(drv->timer_fd); }
+  if (drv->dirty_fd >= 0) { close(drv->dirty_fd); }
+  drv->epoll_fd = drv->timer_fd = drv->dirty_fd = -1;
+}
+
+int impdrv_fd(impdrv_t const *drv) { return drv ? drv->epoll_fd : -1; }
+
+imp_ret_t impdrv_mark_dirty(impdrv_t *drv) {
+  if (!drv || (drv->dirty_fd < 0)) { return IMP_RET_ERR_ARGS; }
+  uint64_t const one = 1;
+  ssize_t r;
+  do { r = write(drv->dirty_fd, &one, sizeof(one)); } while ((r < 0) && (errno == EINTR));
+  // EAGAIN means the counter is saturated, which still reads as dirty.
+  return ((r == (ssize_t)sizeof(one)) || (errno == EAGAIN)) ?
+    IMP_RET_SUCCESS : IMP_RET_ERR_SYSTEM;
+}
+
+imp_ret_t impdrv_dispatch(impdrv_t *drv, bool *out_rendered) {
+  if (out_rendered) { *out_rendered = false; }
+  if (!drv || (drv->epoll_fd < 0)) { return IMP_RET_ERR_ARGS; }
+
+  if (impdrv__drain(drv->dirty_fd)) { drv->dirty = true; }
+  if (impdrv__drain(drv->timer_fd)) { drv->timer_armed = false; }
+  if (!drv->dirty || drv->timer_armed) { return IMP_RET_SUCCESS; }
+
+  uint64_t const now = impdrv__now_nsec();
+  uint64_t const frame_nsec = (uint64_t)drv->frame_msec * 1000000ull;
+  uint64_t const since = now - drv->last_frame_nsec;
+  if (drv->last_frame_nsec && (since < frame_nsec)) {
+    return impdrv__arm(drv, frame_nsec - since);
+  }
+
+  drv->dirty = false;
+  drv->last_frame_nsec = now;
+  drv->render_cb(drv->ctx, drv->render_cb_ctx);
+  if (out_rendered) { *out_rendered = true; }
+  return IMP_RET_SUCCESS;
+}
@@ -0,0 +1,305 @@
+#include "improg/impexp.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Triple buffering: the snapshot side fills back, then swaps it into mid with the fresh flag
+// set; the write side swaps front into mid only when the flag is set. The acq_rel exchanges
+// are the only shared accesses, and each hands a whole buffer from one side to the other.
+#define IMPEXP__FRESH 4u
+#define IMPEXP__INDEX 3u
+
+static uint64_t impexp__now_nsec(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ull) + (uint64_t)ts.tv_nsec;
+}
+
+// Pre-order successor of li, including the children of collapsed lines.
+static uint16_t impexp__next(remp_ctx_t const *ctx, uint16_t li) {
+  remp_line_t const *l = &ctx->lines[li];
+  if (l->first_child != REMP_NO_LINE) { return l->first_child; }
+  while ((li != REMP_NO_LINE) && (ctx->lines[li].next_sibling == REMP_NO_LINE)) {
+    li = ctx->lines[li].parent;
+  }
+  return (li == REMP_NO_LINE) ? REMP_NO_LINE : ctx->lines[li].next_sibling;
+}
+
+static char const *impexp__label(remp_ctx_t const *ctx, remp_line_t const *l) {
+  imp_widget_def_t const *w = l->w;
+  bool const composite = (w->type == IMP_WIDGET_TYPE_COMPOSITE);
+  int const n = composite ? w->w.composite.widget_count : 1;
+  for (int i = 0; i < n; ++i) {
+    uint32_t const vi = l->value_start_idx + (uint32_t)i;
+    if (ctx->value_types[vi] == IMP_VALUE_TYPE_STRING) { return ctx->refs[vi].s; }
+  }
+  for (int i = 0; i < n; ++i) {
+    imp_widget_def_t const *sw = composite ? &w->w.composite.widgets[i] : w;
+    if (sw->type == IMP_WIDGET_TYPE_LABEL) { return sw->w.label.s; }
+  }
+  return NULL;
+}
+
+// Copies s, cut at a codepoint boundary to fit and with trailing spaces + colons trimmed.
+static void impexp__copy_label(char *dst, char const *s) {
+  size_t n = s ? strlen(s) : 0;
+  if (n >= IMPEXP_LABEL_MAX) {
+    n = IMPEXP_LABEL_MAX - 1;
+    while (n && (((unsigned char)s[n] & 0xc0) == 0x80)) { --n; }
+  }
+  while (n && ((s[n - 1] == ' ') || (s[n - 1] == ':'))) { --n; }
+  if (n) { memcpy(dst, s, n); }
+  dst[n] = '\0';
+}
+
+// Progress units per second; dt_nsec is at least the snapshot period.
+static int64_t impexp__rate(int64_t delta, uint64_t dt_nsec) {
+  if (!dt_nsec) { return 0; }
+  if ((delta < (INT64_MAX / 1000000000)) && (delta > (INT64_MIN / 1000000000))) {
+    return (delta * 1000000000) / (int64_t)dt_nsec;
+  }
+  uint64_t const dt_msec = (dt_nsec / 1000000u) ? (dt_nsec / 1000000u) : 1u;
+  return (delta / (int64_t)dt_msec) * 1000;
+}
+
+imp_ret_t impexp_init(impexp_t *exp,
+                      impexp_format_t format,
+                      unsigned period_msec,
+                      impexp_line_t *lines,
+                      impexp_track_t *tracks,
+                      uint16_t max_lines,
+                      char *buf,
+                      uint32_t buf_cap) {
+  if (!exp || !lines || !tracks || !max_lines || !buf || (buf_cap < IMPEXP_BUF_MIN)) {
+    return IMP_RET_ERR_ARGS;
+  }
+  *exp = (impexp_t){ .tracks = tracks, .back = 0, .front = 2,
+    .max_lines = max_lines, .period_msec = period_msec, .format = format, .buf = buf,
+    .buf_cap = buf_cap, .fd = -1 };
+  atomic_init(&exp->mid, 1u);
+  for (unsigned i = 0; i < 3; ++i) {
+    exp->snaps[i] = (impexp_snap_t){ .lines = &lines[i * max_lines] };
+  }
+  for (unsigned i = 0; i < max_lines; ++i) {
+    tracks[i] = (impexp_track_t){ .add_seq = 0, .prog_cur = 0, .snap_seq = 0 };
+  }
+  return IMP_RET_SUCCESS;
+}
+
+imp_ret_t impexp_open_file(impexp_t *exp, char const *path) {
+  if (!exp || !path) { return IMP_RET_ERR_ARGS; }
+  impexp_close(exp);
+  if (exp->format == IMPEXP_FORMAT_PROMETHEUS) { exp->path = path; return IMP_RET_SUCCESS; }
+  exp->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  return (exp->fd < 0) ? IMP_RET_ERR_SYSTEM : IMP_RET_SUCCESS;
+}
+
+imp_ret_t impexp_connect_unix(impexp_t *exp, char const *path) {
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (!exp || !path || (strlen(path) >= sizeof(addr.sun_path))) { return IMP_RET_ERR_ARGS; }
+  impexp_close(exp);
+  memcpy(addr.sun_path, path, strlen(path) + 1u);
+
+  int const fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) { return IMP_RET_ERR_SYSTEM; }
+  (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+  int const one = 1;
+  (void)setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  if (connect(fd, (struct sockaddr const *)&addr, sizeof(addr))) {
+    close(fd);
+    return IMP_RET_ERR_SYSTEM;
+  }
+  exp->fd = fd;
+  exp->is_socket = true;
+  return IMP_RET_SUCCESS;
+}
+
+void impexp_close(impexp_t *exp) {
+  if (!exp) { return; }
+  if (exp->fd >= 0) { close(exp->fd); }
+  exp->fd = -1;
+  exp->is_socket = false;
+  exp->path = NULL;
+}
+
+imp_ret_t impexp_snapshot(impexp_t *exp, remp_ctx_t const *ctx, bool *out_taken) {
+  if (out_taken) { *out_taken = false; }
+  if (!exp || !ctx || (ctx->cfg.max_lines > exp->max_lines)) { return IMP_RET_ERR_ARGS; }
+
+  uint64_t const now = impexp__now_nsec(CLOCK_MONOTONIC);
+  uint64_t const dt = exp->snap_seq ? (now - exp->last_snap_nsec) : 0;
+  if (exp->snap_seq && (dt < ((uint64_t)exp->period_msec * 1000000u))) {
+    return IMP_RET_SUCCESS;
+  }
+
+  impexp_snap_t *snap = &exp->snaps[exp->back];
+  uint16_t n = 0;
+  for (uint16_t li = ctx->first_root; li != REMP_NO_LINE; li = impexp__next(ctx, li)) {
+    remp_line_t const *l = &ctx->lines[li];
+    impexp_track_t *t = &exp->tracks[li];
+    int64_t const cur = ctx->prog_cur[li];
+    bool const tracked = exp->snap_seq && (t->add_seq == ctx->add_seq[li]) &&
+      (t->snap_seq == exp->snap_seq);
+    impexp_line_t *e = &snap->lines[n++];
+    e->prog_cur = cur;
+    e->prog_max = ctx->prog_max[li];
+    e->rate = tracked ? impexp__rate(cur - t->prog_cur, dt) : 0;
+    e->id = li;
+    e->parent = l->parent;
+    impexp__copy_label(e->label, impexp__label(ctx, l));
+    *t = (impexp_track_t){ .add_seq = ctx->add_seq[li], .prog_cur = cur,
+      .snap_seq = exp->snap_seq + 1u };
+  }
+  snap->line_count = n;
+  snap->mono_nsec = now;
+  snap->unix_msec = impexp__now_nsec(CLOCK_REALTIME) / 1000000u;
+  exp->last_snap_nsec = now;
+  ++exp->snap_seq;
+
+  uint32_t const handed = exp->back | IMPEXP__FRESH;
+  exp->back =
+    (uint8_t)(atomic_exchange_explicit(&exp->mid, handed, memory_order_acq_rel) & IMPEXP__INDEX);
+  if (out_taken) { *out_taken = true; }
+  return IMP_RET_SUCCESS;
+}
+
+static void impexp__flush(impexp_t *exp, int fd) {
+  char const *p = exp->buf;
+  size_t n = exp->buf_len;
+  exp->buf_len = 0;
+  while (n && !exp->write_failed) {
+    ssize_t r;
+#ifdef MSG_NOSIGNAL
+    if (exp->is_socket) { r = send(fd, p, n, MSG_NOSIGNAL); } else { r = write(fd, p, n); }
+#else
+    r = write(fd, p, n);
+#endif
+    if ((r < 0) && (errno == EINTR)) { continue; }
+    if (r <= 0) { exp->write_failed = true; break; }
+    p += r;
+    n -= (size_t)r;
+  }
+}
+
+__attribute__((format(printf, 3, 4)))
+static void impexp__printf(impexp_t *exp, int fd, char const *fmt, ...) {
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    va_list args;
+    va_start(args, fmt);
+    uint32_t const room = exp->buf_cap - exp->buf_len;
+    int const len = vsnprintf(&exp->buf[exp->buf_len], room, fmt, args);
+    va_end(args);
+    if ((len >= 0) && ((uint32_t)len < room)) { exp->buf_len += (uint32_t)len; return; }
+    impexp__flush(exp, fd); // retry once, into an empty buffer
+  }
+  exp->write_failed = true; // longer than IMPEXP_BUF_MIN, which can't happen
+}
+
+// JSON escapes " \ and control characters; Prometheus label values escape " \ and newline.
+static void impexp__escape(char const *s, bool json, char *out) {
+  for (; *s; ++s) {
+    unsigned char const c = (unsigned char)*s;
+    if ((c == '"') || (c == '\\')) {
+      *out++ = '\\';
+      *out++ = (char)c;
+    } else if (c == '\n') {
+      *out++ = '\\';
+      *out++ = 'n';
+    } else if (json && (c < 0x20)) {
+      out += snprintf(out, 7, "\\u%04x", c);
+    } else {
+      *out++ = (char)c;
+    }
+  }
+  *out = '\0';
+}
+
+static void impexp__write_json(impexp_t *exp, int fd, impexp_snap_t const *snap) {
+  impexp__printf(exp, fd, "{\"time_ms\":%" PRIu64 ",\"lines\":[", snap->unix_msec);
+  for (unsigned i = 0; i < snap->line_count; ++i) {
+    impexp_line_t const *e = &snap->lines[i];
+    char label[(IMPEXP_LABEL_MAX * 6) + 1], parent[8] = "null";
+    impexp__escape(e->label, true, label);
+    if (e->parent != REMP_NO_LINE) { snprintf(parent, sizeof(parent), "%u", e->parent); }
+    impexp__printf(exp, fd, "%s{\"id\":%u,\"parent\":%s,\"label\":\"%s\",\"cur\":%" PRIi64
+      ",\"max\":%" PRIi64 ",\"rate\":%" PRIi64 "}", i ? "," : "", e->id, parent, label,
+      e->prog_cur, e->prog_max, e->rate);
+  }
+  impexp__printf(exp, fd, "]}\n");
+}
+
+// Prometheus wants each metric's samples together, so the lines are listed once per metric.
+static void impexp__write_prometheus(impexp_t *exp, int fd, impexp_snap_t const *snap) {
+  static char const *const s_metrics[][2] = {
+    { "current", "Line progress, including descendants." },
+    { "max", "Line progress maximum, including descendants." },
+    { "rate", "Line progress per second, over the last snapshot period." },
+  };
+  for (unsigned m = 0; m < 3; ++m) {
+    impexp__printf(exp, fd, "# HELP improg_progress_%s %s\n# TYPE improg_progress_%s gauge\n",
+      s_metrics[m][0], s_metrics[m][1], s_metrics[m][0]);
+    for (unsigned i = 0; i < snap->line_count; ++i) {
+      impexp_line_t const *e = &snap->lines[i];
+      int64_t const v = (m == 0) ? e->prog_cur : (m == 1) ? e->prog_max : e->rate;
+      char label[(IMPEXP_LABEL_MAX * 2) + 1], parent[20] = "";
+      impexp__escape(e->label, false, label);
+      if (e->parent != REMP_NO_LINE) {
+        snprintf(parent, sizeof(parent), ",parent=\"%u\"", e->parent);
+      }
+      impexp__printf(exp, fd, "improg_progress_%s{id=\"%u\"%s,label=\"%s\"} %" PRIi64 "\n",
+        s_metrics[m][0], e->id, parent, label, v);
+    }
+  }
+}
+
+imp_ret_t impexp_write(impexp_t *exp, bool *out_written) {
+  if (out_written) { *out_written = false; }
+  if (!exp || ((exp->fd < 0) && !exp->path)) { return IMP_RET_ERR_ARGS; }
+  if (!(atomic_load_explicit(&exp->mid, memory_order_acquire) & IMPEXP__FRESH)) {
+    return IMP_RET_SUCCESS;
+  }
+  uint32_t const mid = atomic_exchange_explicit(&exp->mid, exp->front, memory_order_acq_rel);
+  exp->front = (uint8_t)(mid & IMPEXP__INDEX);
+  impexp_snap_t const *snap = &exp->snaps[exp->front];
+
+  char tmp_path[PATH_MAX];
+  int fd = exp->fd;
+  if (exp->path) {
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", exp->path) >= (int)sizeof(tmp_path)) {
+      return IMP_RET_ERR_ARGS;
+    }
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { return IMP_RET_ERR_SYSTEM; }
+  }
+
+  exp->write_failed = false;
+  exp->buf_len = 0;
+  if (exp->format == IMPEXP_FORMAT_PROMETHEUS) {
+    impexp__write_prometheus(exp, fd, snap);
+  } else {
+    impexp__write_json(exp, fd, snap);
+  }
+  impexp__flush(exp, fd);
+
+  if (exp->path) {
+    if (close(fd)) { exp->write_failed = true; }
+    if (exp->write_failed || rename(tmp_path, exp->path)) {
+      unlink(tmp_path);
+      exp->write_failed = true;
+    }
+  }
+  if (exp->write_failed) { return IMP_RET_ERR_SYSTEM; }
+  if (out_written) { *out_written = true; }
+  return IMP_RET_SUCCESS;
+}
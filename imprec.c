@@ -0,0 +1,101 @@
+#include "improg/imprec.h"
+
+#include <string.h>
+
+static void imprec__put_u32(unsigned char *dst, uint32_t x) {
+  dst[0] = (unsigned char)x;
+  dst[1] = (unsigned char)(x >> 8);
+  dst[2] = (unsigned char)(x >> 16);
+  dst[3] = (unsigned char)(x >> 24);
+}
+
+static uint32_t imprec__get_u32(unsigned char const *src) {
+  return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) |
+    ((uint32_t)src[3] << 24);
+}
+
+static size_t imprec__padded(size_t payload_len) { return (payload_len + 1u + 3u) & ~(size_t)3u; }
+
+static void imprec__write_record(imprec_t *rec, char const *s, uint32_t len, uint32_t flags) {
+  static unsigned char const s_zeros[4] = { 0, 0, 0, 0 };
+  unsigned char hdr[8];
+  imprec__put_u32(hdr, len);
+  imprec__put_u32(&hdr[4], flags);
+  size_t const pad = imprec__padded(len) - len;
+  bool ok = fwrite(hdr, 1, sizeof(hdr), rec->f) == sizeof(hdr);
+  ok = ok && (!len || (fwrite(s, 1, len, rec->f) == len));
+  ok = ok && (fwrite(s_zeros, 1, pad, rec->f) == pad);
+  if (!ok) { rec->write_failed = true; }
+}
+
+imp_ret_t imprec_init(imprec_t *rec,
+                      FILE *f,
+                      char *buf,
+                      uint32_t buf_cap,
+                      imp_print_cb_t next_cb,
+                      void *next_cb_ctx) {
+  if (!rec || !f || !buf || !buf_cap) { return IMP_RET_ERR_ARGS; }
+  *rec = (imprec_t){ .f = f, .next_cb = next_cb, .next_cb_ctx = next_cb_ctx, .buf = buf,
+    .buf_cap = buf_cap };
+  if (fwrite(IMPREC_MAGIC, 1, 8, f) != 8) { return IMP_RET_ERR_SYSTEM; }
+  return IMP_RET_SUCCESS;
+}
+
+void imprec_print_cb(void *ctx, char const *s) {
+  imprec_t *rec = (imprec_t *)ctx;
+  if (rec->next_cb) { rec->next_cb(rec->next_cb_ctx, s); }
+
+  if (!s) { // flush: frame boundary
+    imprec__write_record(rec, rec->buf, rec->buf_len, IMPREC_FLAG_END_OF_FRAME);
+    rec->buf_len = 0;
+    ++rec->frame_count;
+    fflush(rec->f);
+    return;
+  }
+
+  size_t const n = strlen(s);
+  if ((rec->buf_len + n) > rec->buf_cap) {
+    imprec__write_record(rec, rec->buf, rec->buf_len, 0);
+    rec->buf_len = 0;
+  }
+  if (n > rec->buf_cap) {
+    imprec__write_record(rec, s, (uint32_t)n, 0);
+    return;
+  }
+  memcpy(&rec->buf[rec->buf_len], s, n);
+  rec->buf_len += (uint32_t)n;
+}
+
+imp_ret_t imprec_replay(void const *data,
+                        size_t len,
+                        imp_print_cb_t print_cb,
+                        void *print_cb_ctx,
+                        imprec_stats_t *out_stats) {
+  if (!data || !print_cb) { return IMP_RET_ERR_ARGS; }
+  unsigned char const *p = (unsigned char const *)data;
+  if ((len < 8) || memcmp(p, IMPREC_MAGIC, 8)) { return IMP_RET_ERR_ARGS; }
+
+  imprec_stats_t stats = { .byte_count = 0, .frame_count = 0 };
+  size_t off = 8;
+  while (off < len) {
+    if ((len - off) < 8) { return IMP_RET_ERR_ARGS; }
+    uint32_t const rec_len = imprec__get_u32(&p[off]);
+    uint32_t const flags = imprec__get_u32(&p[off + 4]);
+    off += 8;
+    // Payload + NUL must fit before padding is computed, which could wrap a 32-bit size_t.
+    if (rec_len >= (len - off)) { return IMP_RET_ERR_ARGS; }
+    size_t const padded = imprec__padded(rec_len);
+    if (((len - off) < padded) || p[off + rec_len]) { return IMP_RET_ERR_ARGS; }
+
+    if (rec_len) { print_cb(print_cb_ctx, (char const *)&p[off]); }
+    stats.byte_count += rec_len;
+    if (flags & IMPREC_FLAG_END_OF_FRAME) {
+      print_cb(print_cb_ctx, NULL);
+      ++stats.frame_count;
+    }
+    off += padded;
+  }
+
+  if (out_stats) { *out_stats = stats; }
+  return IMP_RET_SUCCESS;
+}
@@ -0,0 +1,70 @@
+#include "improg/impring.h"
+
+#include <string.h>
+
+// Hands the longest contiguous queued run to the transport, wrapping at most once per chunk.
+static void impring__start(impring_t *ring) {
+  uint32_t const queued = ring->committed - ring->tail;
+  if (ring->in_flight || !queued) { return; }
+  uint32_t const off = ring->tail & ring->mask;
+  uint32_t const contiguous = (ring->mask + 1u) - off;
+  ring->in_flight = (queued < contiguous) ? queued : contiguous;
+  ring->start_cb(ring->start_cb_ctx, &ring->buf[off], ring->in_flight);
+}
+
+imp_ret_t impring_init(impring_t *ring,
+                       char *buf,
+                       uint32_t capacity,
+                       impring_start_cb_t start_cb,
+                       void *start_cb_ctx) {
+  if (!ring || !buf || !start_cb || !capacity || (capacity & (capacity - 1u))) {
+    return IMP_RET_ERR_ARGS;
+  }
+  *ring = (impring_t){ .buf = buf, .mask = capacity - 1u, .start_cb = start_cb,
+    .start_cb_ctx = start_cb_ctx };
+  return IMP_RET_SUCCESS;
+}
+
+// Commits the staged frame, or rolls it back if any of it was dropped: a partial frame could
+// end mid-escape or leave the cursor somewhere imp_ctx doesn't expect.
+static void impring__end_frame(impring_t *ring) {
+  uint32_t const staged = ring->head - ring->committed;
+  if (ring->overflowed) {
+    ring->head = ring->committed;
+    ring->bytes_dropped += staged;
+    ++ring->frames_dropped;
+    ring->overflowed = false;
+  } else {
+    ring->committed = ring->head;
+    ring->bytes_written += staged;
+  }
+  impring__start(ring);
+}
+
+void impring_write_cb(void *ctx, char const *data, size_t len) {
+  impring_t *ring = (impring_t *)ctx;
+  if (!data) { impring__end_frame(ring); return; }
+  if (ring->overflowed || (len > impring_free(ring))) {
+    ring->overflowed = true;
+    ring->bytes_dropped += len;
+    return;
+  }
+
+  uint32_t const off = ring->head & ring->mask;
+  uint32_t const first = (uint32_t)len < ((ring->mask + 1u) - off) ?
+    (uint32_t)len : ((ring->mask + 1u) - off);
+  memcpy(&ring->buf[off], data, first);
+  memcpy(ring->buf, data + first, len - first);
+  ring->head += (uint32_t)len;
+}
+
+void impring_complete(impring_t *ring) {
+  if (!ring || !ring->in_flight) { return; }
+  ring->tail += ring->in_flight;
+  ring->in_flight = 0;
+  impring__start(ring);
+}
+
+uint32_t impring_free(impring_t const *ring) {
+  return ring ? ((ring->mask + 1u) - (ring->head - ring->tail)) : 0;
+}
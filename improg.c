@@ -12,71 +12,440 @@
 #endif
 
 #include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 static int imp_util__wchar_display_width(uint32_t wc);
 static int imp_util__wchar_from_utf8(unsigned char const *s, uint32_t *out);
+static int imp_util__wchar_from_utf8_n(unsigned char const *s, size_t n, uint32_t *out);
+static int imp_util__display_width_n(char const *utf8_str, size_t n);
 
 static int imp__max(int a, int b) { return a > b ? a : b; }
 static int imp__min(int a, int b) { return a < b ? a : b; }
 static int imp__clamp(int lo, int x, int hi) { return (x < lo) ? lo : (x > hi) ? hi : x; }
 
+#ifndef IMP_FIXED_POINT
 static float imp__clampf(float lo, float x, float hi) {
   return (x < lo) ? lo : (x > hi) ? hi : x;
 }
+#endif
+
+static void imp__default_write_cb(void *ctx, char const *data, size_t len) {
+  (void)ctx; data ? (void)fwrite(data, 1, len, stdout) : (void)fflush(stdout);
+}
+
+// s[len] must be '\0', so print callbacks can take s as-is.
+static void imp__print_len(imp_ctx_t *ctx, char const *s, size_t len) {
+  if (ctx->write_cb) {
+    ctx->write_cb(ctx->print_cb_ctx, s, len);
+    ctx->frame_bytes += (uint32_t)len;
+  } else {
+    ctx->print_cb(ctx->print_cb_ctx, s);
+  }
+}
+
+// Literals are measured at compile time.
+#define IMP__PRINT_LIT(CTX, LIT) imp__print_len((CTX), (LIT), sizeof(LIT) - 1u)
 
-static void imp__default_print_cb(void *ctx, char const *s) {
-  (void)ctx; s ? printf("%s", s) : fflush(stdout);
+// Emits a formatter's output; len is its return value, which may exceed what fit in cap.
+static void imp__print_fmt(imp_ctx_t *ctx, char const *buf, int len, size_t cap) {
+  if (len > 0) { imp__print_len(ctx, buf, ((size_t)len < cap) ? (size_t)len : (cap - 1u)); }
 }
 
 static void imp__print(imp_ctx_t *ctx, char const *s, int *dw) {
-  ctx->print_cb(ctx->print_cb_ctx, s);
-  if (s && dw) { *dw += imp_util_get_display_width(s); }
+  if (!s) {
+    if (ctx->write_cb) {
+      ctx->write_cb(ctx->print_cb_ctx, NULL, 0);
+    } else {
+      ctx->print_cb(ctx->print_cb_ctx, NULL);
+    }
+    return;
+  }
+  imp__print_len(ctx, s, ctx->write_cb ? strlen(s) : 0);
+  if (dw) { *dw += imp_util_get_display_width(s); }
+}
+
+static unsigned imp__width_cache_slot(imp_ctx_t const *ctx, char const *s) {
+  uint64_t const h = (uint64_t)(uintptr_t)s * 0x9E3779B97F4A7C15ull; // fibonacci hash
+  return (unsigned)(h >> 32) & (ctx->width_cache_capacity - 1u);
+}
+
+static imp_width_entry_t const *imp__width_cache_find(imp_ctx_t const *ctx, char const *s) {
+  if (ctx->width_cache) {
+    unsigned const mask = ctx->width_cache_capacity - 1u;
+    unsigned i = imp__width_cache_slot(ctx, s);
+    for (unsigned n = 0; n <= mask; ++n, i = (i + 1) & mask) {
+      imp_width_entry_t const *e = &ctx->width_cache[i];
+      if (e->s == s) { return e; }
+      if (!e->s) { break; }
+    }
+  }
+  return NULL;
+}
+
+static int imp__const_width(imp_ctx_t const *ctx, char const *s) {
+  imp_width_entry_t const *e = imp__width_cache_find(ctx, s);
+  return e ? e->dw : imp_util_get_display_width(s);
+}
+
+static void imp__print_const(imp_ctx_t *ctx, char const *s, int *dw) {
+  if (!s) { return; }
+  imp_width_entry_t const *e = imp__width_cache_find(ctx, s);
+  if (!e) { imp__print(ctx, s, dw); return; }
+  imp__print_len(ctx, s, e->len);
+  if (dw) { *dw += e->dw; }
+}
+
+// Emits the first n bytes of s. Write callbacks take the span in place, as do print callbacks
+// when s[n] is known to be '\0'; otherwise it's staged through a local buffer in
+// codepoint-aligned chunks. s[n] is never read unless terminated.
+static void imp__print_n(imp_ctx_t *ctx, char const *s, int n, bool terminated) {
+  if (n <= 0) { return; }
+  if (ctx->write_cb || terminated) { imp__print_len(ctx, s, (size_t)n); return; }
+  char buf[128];
+  while (n > 0) {
+    int chunk = imp__min(n, (int)sizeof(buf) - 1);
+    if (chunk < n) {
+      while ((chunk > 0) && (((unsigned char)s[chunk] & 0xc0) == 0x80)) { --chunk; }
+      if (!chunk) { chunk = imp__min(n, (int)sizeof(buf) - 1); }
+    }
+    memcpy(buf, s, (size_t)chunk);
+    buf[chunk] = '\0';
+    imp__print_len(ctx, buf, (size_t)chunk);
+    s += chunk;
+    n -= chunk;
+  }
+}
+
+// Paints n copies of a glyph: one REP sequence when the terminal supports it and it's
+// shorter, otherwise whole runs of the glyph replicated into a local buffer.
+static void imp__print_run(imp_ctx_t *ctx, char const *glyph, int n) {
+  if ((n <= 0) || !glyph || !*glyph) { return; }
+  int const g_len = (int)strlen(glyph);
+
+  if ((ctx->term_caps & IMP_TERM_CAP_REP) && (n > 1) &&
+      (imp_util__wchar_from_utf8((unsigned char const *)glyph, NULL) == g_len)) {
+    char rep[16];
+    int const rep_len = snprintf(rep, sizeof(rep), IMP_REPEAT, n - 1);
+    if (rep_len < (n - 1) * g_len) {
+      imp__print_len(ctx, glyph, (size_t)g_len);
+      imp__print_len(ctx, rep, (size_t)rep_len);
+      return;
+    }
+  }
+
+  char run[128];
+  int const copies = imp__min(n, (int)(sizeof(run) - 1) / g_len);
+  if (!copies) {
+    for (int i = 0; i < n; ++i) { imp__print_len(ctx, glyph, (size_t)g_len); }
+    return;
+  }
+  for (int i = 0; i < copies; ++i) { memcpy(&run[i * g_len], glyph, (size_t)g_len); }
+  run[copies * g_len] = '\0';
+  for (; n >= copies; n -= copies) { imp__print_len(ctx, run, (size_t)(copies * g_len)); }
+  if (n) { run[n * g_len] = '\0'; imp__print_len(ctx, run, (size_t)(n * g_len)); }
 }
 
 static bool imp__value_type_is_scalar(imp_value_t const *v) {
   if (!v) { return false; }
+#ifdef IMP_NO_DOUBLE
+  return v->type == IMP_VALUE_TYPE_INT;
+#else
   return (v->type == IMP_VALUE_TYPE_DOUBLE) || (v->type == IMP_VALUE_TYPE_INT);
+#endif
 }
 
 static bool imp__value_to_int(imp_value_t const *v, imp_value_t *out_iv) {
   if (!imp__value_type_is_scalar(v)) { return false; }
   if (v->type == IMP_VALUE_TYPE_INT) { *out_iv = *v; return true; }
+#ifndef IMP_NO_DOUBLE
   *out_iv = (imp_value_t) { .type = IMP_VALUE_TYPE_INT, .v = { .i = (int64_t)v->v.d } };
+#endif
   return true;
 }
 
+#ifndef IMP_NO_DOUBLE
 static bool imp__value_to_float(imp_value_t const *v, imp_value_t *out_fv) {
   if (!imp__value_type_is_scalar(v)) { return false; }
   if (v->type == IMP_VALUE_TYPE_DOUBLE) { *out_fv = *v; return true; }
   *out_fv = (imp_value_t) { .type = IMP_VALUE_TYPE_DOUBLE, .v = { .d = (double)v->v.i } };
   return true;
 }
+#endif
+
+// Scales a byte count down by 2^shift. Fixed-point builds keep integers exact and leave the
+// shift for imp__fixed_write to apply while formatting.
+static void imp__value_to_size(imp_value_t const *v,
+                               int shift,
+                               imp_value_t *out_v,
+                               int *out_shift) {
+#ifdef IMP_FIXED_POINT
+  if (v->type == IMP_VALUE_TYPE_INT) { *out_v = *v; *out_shift = shift; return; }
+#else
+  (void)out_shift;
+#endif
+#ifndef IMP_NO_DOUBLE
+  imp__value_to_float(v, out_v);
+  out_v->v.d /= (double)(1ull << shift);
+#else
+  (void)v; (void)out_v;
+#endif
+}
+
+#ifdef IMP_FIXED_POINT
+// Writes num / 2^shift as "%*.*f" would, with integer math: precision digits (6 if -1, past
+// the 9th all 0), rounded half to even, right-aligned in field_width, then suffix.
+static int imp__fixed_write(int field_width,
+                            int precision,
+                            int64_t num,
+                            int shift,
+                            char const *suffix,
+                            char *out_buf,
+                            unsigned buf_len) {
+  static uint64_t const s_pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+                                      100000000, 1000000000 };
+  int const pr_all = (precision < 0) ? 6 : precision;
+  int const pr = imp__min(pr_all, 9);
+  bool const neg = num < 0;
+  uint64_t mag = neg ? (0u - (uint64_t)num) : (uint64_t)num;
+  if (shift > 32) { mag >>= (shift - 32); shift = 32; } // keeps the digit math in 64 bits
+  uint64_t const mask = (1ull << shift) - 1u;
+  uint64_t whole = mag >> shift;
+  uint64_t frac = 0;
+  if (shift) {
+    uint64_t const scaled = (mag & mask) * s_pow10[pr];
+    uint64_t const rem = scaled & mask, half = 1ull << (shift - 1);
+    frac = scaled >> shift;
+    uint64_t const last = pr ? frac : whole;
+    if ((rem > half) || ((rem == half) && (last & 1u))) { ++frac; }
+    if (frac == s_pow10[pr]) { ++whole; frac = 0; }
+  }
+
+  char num_buf[48];
+  int num_len;
+  if (pr) {
+    num_len = snprintf(num_buf, sizeof(num_buf), "%s%" PRIu64 ".%0*" PRIu64, neg ? "-" : "",
+      whole, pr, frac);
+  } else {
+    num_len = snprintf(num_buf, sizeof(num_buf), "%s%" PRIu64, neg ? "-" : "", whole);
+  }
+  for (int i = pr; (i < pr_all) && (num_len < ((int)sizeof(num_buf) - 1)); ++i) {
+    num_buf[num_len++] = '0';
+  }
+  num_buf[num_len] = '\0';
+  return snprintf(out_buf, buf_len, "%*s%s", imp__max(0, field_width), num_buf, suffix);
+}
+#endif
+
+// Packed programs (see imp_pack_widget). Multi-byte fields are little-endian and unaligned;
+// lists (sub-widget node offsets, spinner frames, progress label entries) start on an
+// IMP_PACK_ALIGN boundary, so a decoded def's list fields can point straight at them.
+_Static_assert(_Alignof(imp_widget_def_t) <= IMP_PACK_ALIGN, "packed lists misaligned");
+_Static_assert(_Alignof(imp_widget_progress_label_entry_t) <= IMP_PACK_ALIGN,
+               "packed lists misaligned");
+
+#define IMP__PACK_NONE 0xFFFFu // offset of an absent string or list
+#define IMP__PACK_LABEL_ENTRY_SIZE 6u // i32 Q2.30 threshold, u16 string
+
+static uint16_t imp__pack_u16(uint8_t const *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static int16_t imp__pack_i16(uint8_t const *p) { return (int16_t)imp__pack_u16(p); }
+
+static void imp__pack_put_u16(uint8_t *p, unsigned v) {
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+}
+
+static int32_t imp__pack_i32(uint8_t const *p) {
+  return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+                   ((uint32_t)p[3] << 24));
+}
+
+static void const *imp__pack_ptr(uint8_t const *pack, uint8_t const *p) {
+  uint16_t const off = imp__pack_u16(p);
+  return (off == IMP__PACK_NONE) ? NULL : (void const *)&pack[off];
+}
+
+static imp_fraction_t imp__pack_threshold(uint8_t const *p) {
+#ifdef IMP_FIXED_POINT
+  return (imp_fraction_t)imp__pack_i32(p) * 4;
+#else
+  return (float)imp__pack_i32(p) * (1.f / 1073741824.f);
+#endif
+}
+
+// Expands the node at pack[off] into out. Lists stay packed: composite widgets, edge fill,
+// bouncer, spinner frames, progress labels and bar segments point at them, and are read via
+// imp__child, imp__spinner_frame, imp__progress_label_entry and imp__stacked_bar_segment.
+static void imp__pack_decode(uint8_t const *pack, uint16_t off, imp_widget_def_t *out) {
+  uint8_t const *p = &pack[off];
+  *out = (imp_widget_def_t){ .type = (imp_widget_type_t)p[0] };
+  switch (out->type) {
+    case IMP_WIDGET_TYPE_LABEL: out->w.label.s = imp__pack_ptr(pack, &p[1]); break;
+
+    case IMP_WIDGET_TYPE_STRING:
+      out->w.str = (imp_widget_string_t){ .trim_left = p[1] != 0,
+        .field_width = imp__pack_i16(&p[2]), .max_len = imp__pack_i16(&p[4]),
+        .custom_trim = imp__pack_ptr(pack, &p[6]) };
+      break;
+
+    case IMP_WIDGET_TYPE_SCALAR:
+    case IMP_WIDGET_TYPE_PROGRESS_FRACTION:
+    case IMP_WIDGET_TYPE_PROGRESS_SCALAR: // identical layouts
+      out->w.scalar = (imp_widget_scalar_t){ .unit = (imp_unit_t)p[1],
+        .field_width = imp__pack_i16(&p[2]), .precision = imp__pack_i16(&p[4]) };
+      break;
+
+    case IMP_WIDGET_TYPE_PROGRESS_PERCENT:
+      out->w.progress_percent = (imp_widget_progress_percent_t){
+        .field_width = imp__pack_i16(&p[1]), .precision = imp__pack_i16(&p[3]) };
+      break;
+
+    case IMP_WIDGET_TYPE_SPINNER:
+      out->w.spinner = (imp_widget_spinner_t){ .speed_msec = imp__pack_u16(&p[1]),
+        .frame_count = imp__pack_u16(&p[3]), .frames = imp__pack_ptr(pack, &p[5]) };
+      break;
+
+    case IMP_WIDGET_TYPE_PROGRESS_LABEL:
+      out->w.progress_label = (imp_widget_progress_label_t){
+        .field_width = imp__pack_i16(&p[1]), .label_count = imp__pack_i16(&p[3]),
+        .labels = imp__pack_ptr(pack, &p[5]) };
+      break;
+
+    case IMP_WIDGET_TYPE_PROGRESS_BAR:
+      out->w.progress_bar = (imp_widget_progress_bar_t){ .scale_fill = p[1] != 0,
+        .field_width = imp__pack_i16(&p[2]), .left_end = imp__pack_ptr(pack, &p[4]),
+        .right_end = imp__pack_ptr(pack, &p[6]), .full_fill = imp__pack_ptr(pack, &p[8]),
+        .empty_fill = imp__pack_ptr(pack, &p[10]), .edge_fill = imp__pack_ptr(pack, &p[12]) };
+      break;
+
+    case IMP_WIDGET_TYPE_PING_PONG_BAR:
+      out->w.ping_pong_bar = (imp_widget_ping_pong_bar_t){
+        .field_width = imp__pack_i16(&p[1]), .left_end = imp__pack_ptr(pack, &p[3]),
+        .right_end = imp__pack_ptr(pack, &p[5]), .fill = imp__pack_ptr(pack, &p[7]),
+        .bouncer = imp__pack_ptr(pack, &p[9]) };
+      break;
+
+    case IMP_WIDGET_TYPE_COMPOSITE:
+      out->w.composite = (imp_widget_composite_t){ .max_len = imp__pack_i16(&p[1]),
+        .widget_count = imp__pack_i16(&p[3]), .widgets = imp__pack_ptr(pack, &p[5]) };
+      break;
+
+    case IMP_WIDGET_TYPE_STACKED_BAR:
+      out->w.stacked_bar = (imp_widget_stacked_bar_t){ .field_width = imp__pack_i16(&p[1]),
+        .segment_count = imp__pack_i16(&p[3]), .left_end = imp__pack_ptr(pack, &p[5]),
+        .right_end = imp__pack_ptr(pack, &p[7]), .empty_fill = imp__pack_ptr(pack, &p[9]),
+        .segments = imp__pack_ptr(pack, &p[11]) };
+      break;
+
+    case IMP_WIDGET_TYPE_SPARKLINE:
+      out->w.sparkline = (imp_widget_sparkline_t){ .field_width = imp__pack_i16(&p[1]) };
+      break;
+
+    default: break;
+  }
+}
+
+// While ctx->pack is set, def lists hold node offsets: root becomes a one-entry list of node,
+// aligned as a def list so it can be passed as one.
+typedef union imp__pack_root {
+  imp_widget_def_t const *align;
+  uint8_t node[2];
+} imp__pack_root_t;
+_Static_assert(_Alignof(imp__pack_root_t) >= _Alignof(imp_widget_def_t), "root misaligned");
+
+static imp_widget_def_t const *imp__pack_root(uint16_t node, imp__pack_root_t *root) {
+  imp__pack_put_u16(root->node, node);
+  return (imp_widget_def_t const *)(void const *)root;
+}
+
+// Sub-widget i of a composite, edge fill or bouncer list. While a packed program runs, lists
+// hold node offsets and the node is decoded into ctx->pack_defs[slot]: the walks and the draw
+// loop decode into one slot, and the width measurements they start into the other.
+enum { IMP__DEF_DRAWN, IMP__DEF_MEASURED, IMP__DEF_SLOTS };
+
+static imp_widget_def_t const *imp__child(imp_ctx_t const *ctx,
+                                          imp_widget_def_t const *list,
+                                          int i,
+                                          int slot) {
+  if (!ctx || !ctx->pack) { return &list[i]; }
+  uint8_t const *const offs = (uint8_t const *)(void const *)list;
+  imp__pack_decode(ctx->pack, imp__pack_u16(&offs[2 * i]), &ctx->pack_defs[slot]);
+  return &ctx->pack_defs[slot];
+}
 
-static char const *imp__progress_label_get_string(imp_widget_progress_label_t const *pl,
-                                                  float progress) {
+static char const *imp__progress_label_entry(imp_ctx_t const *ctx,
+                                             imp_widget_progress_label_t const *pl,
+                                             int li,
+                                             imp_fraction_t *out_threshold) {
+  if (!ctx->pack) {
+    *out_threshold = pl->labels[li].threshold;
+    return pl->labels[li].s;
+  }
+  uint8_t const *e =
+    (uint8_t const *)(void const *)pl->labels + ((unsigned)li * IMP__PACK_LABEL_ENTRY_SIZE);
+  *out_threshold = imp__pack_threshold(e);
+  return imp__pack_ptr(ctx->pack, &e[4]);
+}
+
+static char const *imp__progress_label_get_string(imp_ctx_t const *ctx,
+                                                  imp_widget_progress_label_t const *pl,
+                                                  imp_fraction_t progress) {
   for (int li = 0; li < pl->label_count; ++li) {
-    if (progress < pl->labels[li].threshold) { return pl->labels[li].s; }
+    imp_fraction_t threshold;
+    char const *s = imp__progress_label_entry(ctx, pl, li, &threshold);
+    if (progress < threshold) { return s; }
   }
   return NULL;
 }
 
-static char const *imp__spinner_get_string(imp_widget_spinner_t const *s, unsigned msec) {
-  unsigned const idx = (unsigned)((float)msec / (float)s->speed_msec);
-  return s->frames[idx % (unsigned)s->frame_count];
+static char const *imp__spinner_frame(imp_ctx_t const *ctx,
+                                      imp_widget_spinner_t const *s,
+                                      unsigned idx) {
+  if (!ctx->pack) { return s->frames[idx]; }
+  return imp__pack_ptr(ctx->pack, (uint8_t const *)(void const *)s->frames + (2 * idx));
+}
+
+static char const *imp__spinner_get_string(imp_ctx_t const *ctx,
+                                           imp_widget_spinner_t const *s,
+                                           unsigned msec) {
+  unsigned const idx = msec / s->speed_msec;
+  return imp__spinner_frame(ctx, s, idx % (unsigned)s->frame_count);
+}
+
+static imp_widget_stacked_bar_segment_t imp__stacked_bar_segment(
+  imp_ctx_t const *ctx, imp_widget_stacked_bar_t const *sb, int si) {
+  if (!ctx->pack) { return sb->segments[si]; }
+  uint8_t const *e = (uint8_t const *)(void const *)sb->segments + (4u * (unsigned)si);
+  return (imp_widget_stacked_bar_segment_t){ .color = imp__pack_ptr(ctx->pack, &e[0]),
+    .fill = imp__pack_ptr(ctx->pack, &e[2]) };
 }
 
+// frac_shift is 0, or for fixed-point fractions, the bits of v (an INT) below the binary point.
 static int imp__value_write(int field_width,
                             int precision,
                             imp_unit_t unit,
                             imp_value_t const *v,
+                            int frac_shift,
                             char *out_buf,
                             unsigned buf_len) {
   imp_value_t conv_v = *v;
   imp_unit_t conv_u = unit;
+  int size_shift = 0; // pending divide by 2^size_shift, fixed-point integers only
+#ifdef IMP_FIXED_POINT
+  // Fractions print as such unitless or in KB/MB/GB; the other units count whole ones.
+  imp_value_t whole_v;
+  if (frac_shift && (v->type == IMP_VALUE_TYPE_INT) && (unit != IMP_UNIT_NONE) &&
+      (unit != IMP_UNIT_SIZE_KB) && (unit != IMP_UNIT_SIZE_MB) && (unit != IMP_UNIT_SIZE_GB)) {
+    whole_v = (imp_value_t)IMP_VALUE_INT(v->v.i / ((int64_t)1 << frac_shift)); // as (int)
+    v = &whole_v;
+    conv_v = whole_v;
+    frac_shift = 0;
+  }
+#endif
 
   switch (unit) {
-    case IMP_UNIT_NONE: break;
+    case IMP_UNIT_NONE: size_shift = frac_shift; break;
 
     case IMP_UNIT_SIZE_B:
       // TODO: validate v type
@@ -85,20 +454,17 @@ static int imp__value_write(int field_width,
 
     case IMP_UNIT_SIZE_KB:
       // TODO: validate v type
-      imp__value_to_float(v, &conv_v);
-      conv_v.v.d /= 1024.;
+      imp__value_to_size(v, 10 + frac_shift, &conv_v, &size_shift);
       break;
 
     case IMP_UNIT_SIZE_MB:
       // TODO: validate v type
-      imp__value_to_float(v, &conv_v);
-      conv_v.v.d /= (1024. * 1024.);
+      imp__value_to_size(v, 20 + frac_shift, &conv_v, &size_shift);
       break;
 
     case IMP_UNIT_SIZE_GB:
       // TODO: validate v type
-      imp__value_to_float(v, &conv_v);
-      conv_v.v.d /= (1024. * 1024. * 1024.);
+      imp__value_to_size(v, 30 + frac_shift, &conv_v, &size_shift);
       break;
 
     case IMP_UNIT_SIZE_DYNAMIC:
@@ -106,18 +472,15 @@ static int imp__value_write(int field_width,
       if (v->v.i < 1024) {
         imp__value_to_int(v, &conv_v);
         conv_u = IMP_UNIT_SIZE_B;
+      } else if (v->v.i < (1024 * 1024)) {
+        imp__value_to_size(v, 10, &conv_v, &size_shift);
+        conv_u = IMP_UNIT_SIZE_KB;
+      } else if (v->v.i < (1024LL * 1024 * 1024)) {
+        imp__value_to_size(v, 20, &conv_v, &size_shift);
+        conv_u = IMP_UNIT_SIZE_MB;
       } else {
-        imp__value_to_float(v, &conv_v);
-        if (v->v.i < (1024 * 1024)) {
-          conv_v.v.d /= 1024.;
-          conv_u = IMP_UNIT_SIZE_KB;
-        } else if (v->v.i < (1024LL * 1024 * 1024)) {
-          conv_v.v.d /= (1024. * 1024.);
-          conv_u = IMP_UNIT_SIZE_MB;
-        } else {
-          conv_v.v.d /= (1024. * 1024. * 1024.);
-          conv_u = IMP_UNIT_SIZE_GB;
-        }
+        imp__value_to_size(v, 30, &conv_v, &size_shift);
+        conv_u = IMP_UNIT_SIZE_GB;
       }
       break;
 
@@ -181,9 +544,18 @@ static int imp__value_write(int field_width,
 
   switch (conv_v.type) {
     case IMP_VALUE_TYPE_INT:
+#ifdef IMP_FIXED_POINT
+      if (size_shift) {
+        return imp__fixed_write(
+          have_fw ? fw : 0, precision, conv_v.v.i, size_shift, us, out_buf, buf_len);
+      }
+#endif
       if (!have_fw) { return snprintf(out_buf, buf_len, "%" PRIi64 "%s", conv_v.v.i, us); }
       return snprintf(out_buf, buf_len, "%*" PRIi64 "%s", fw, conv_v.v.i, us);
 
+#ifdef IMP_NO_DOUBLE
+    case IMP_VALUE_TYPE_DOUBLE: break;
+#else
     case IMP_VALUE_TYPE_DOUBLE: {
       bool const have_pr = (precision != -1);
       int const pr = precision;
@@ -193,9 +565,12 @@ static int imp__value_write(int field_width,
       if (!have_fw && have_pr) { return snprintf(out_buf, buf_len, "%.*f%s", pr, d, us); }
       return snprintf(out_buf, buf_len, "%*.*f%s", fw, pr, d, us);
     }
+#endif
 
     case IMP_VALUE_TYPE_STRING: break;
+    case IMP_VALUE_TYPE_STRING_SPAN: break;
     case IMP_VALUE_TYPE_COMPOSITE: break;
+    case IMP_VALUE_TYPE_HISTORY: break;
     case IMP_VALUE_TYPE_NULL: break;
     default: break;
   }
@@ -207,129 +582,199 @@ static int imp__scalar_write(imp_widget_scalar_t const *s,
                              imp_value_t const *v,
                              char *out_buf,
                              unsigned buf_len) {
-  return imp__value_write(s->field_width, s->precision, s->unit, v, out_buf, buf_len);
+  return imp__value_write(s->field_width, s->precision, s->unit, v, 0, out_buf, buf_len);
 }
 
 static int imp__progress_scalar_write(imp_widget_progress_scalar_t const *s,
                                       imp_value_t const *v,
+                                      int frac_shift,
                                       char *out_buf,
                                       unsigned buf_len) {
-  return imp__value_write(s->field_width, s->precision, s->unit, v, out_buf, buf_len);
-}
-
-static bool imp__clipped_str_len(char const *str,
-                                 int max_len,
-                                 int custom_trim_len,
-                                 int *out_sml_len,
-                                 int *out_sctml_len) {
-  int sml_len = 0, sctml_len = -1;
-  int const max_ctlen =
-    custom_trim_len >= 0 ? imp__max(0, max_len - custom_trim_len) : max_len;
-  unsigned char const *cur = (unsigned char const *)str;
-  while (*cur) {
+  return imp__value_write(s->field_width, s->precision, s->unit, v, frac_shift, out_buf,
+                          buf_len);
+}
+
+// Progress values are fixed-point fractions of 1 inside a fixed-point scale-fill edge, which
+// the float build passes as doubles instead.
+static int imp__progress_frac_shift(imp_ctx_t const *ctx) {
+#ifdef IMP_FIXED_POINT
+  return ctx->progress_q32 ? 32 : 0;
+#else
+  (void)ctx;
+  return 0;
+#endif
+}
+
+typedef struct imp__str_clip {
+  int len, ct_len; // widths of the longest prefixes fitting max_len, and max_len - trim_len
+  int end, ct_end; // byte offsets where those prefixes first reach their widths
+  int off; // bytes read: all of str, or if clipped, up to the first glyph that didn't fit
+  bool clipped;
+} imp__str_clip_t;
+
+// One forward pass over at most n bytes of str, stopping at the first glyph that doesn't fit
+// in max_len (-1 for no limit).
+static bool imp__str_clip(char const *str,
+                          int n,
+                          int max_len,
+                          int trim_len,
+                          imp__str_clip_t *out) {
+  int const max_ctlen = imp__max(0, max_len - trim_len);
+  unsigned char const *src = (unsigned char const *)str;
+  int w = 0, off = 0, end = 0;
+  *out = (imp__str_clip_t){
+    .len = 0, .ct_len = -1, .end = 0, .ct_end = 0, .off = 0, .clipped = false
+  };
+  while ((off < n) && src[off]) {
     uint32_t wc;
-    cur += imp_util__wchar_from_utf8(cur, &wc);
+    int const wc_l = imp_util__wchar_from_utf8_n(&src[off], (size_t)(n - off), &wc);
     int const dw = imp_util__wchar_display_width(wc);
     if (dw < 0) { return false; }
-    int const new_len = sml_len + dw;
     if (max_len >= 0) {
-      if ((new_len > max_ctlen) && (sctml_len == -1)) { sctml_len = sml_len; }
-      if (new_len > max_len) { break; }
+      if (((w + dw) > max_ctlen) && (out->ct_len == -1)) { out->ct_len = w; out->ct_end = end; }
+      if ((w + dw) > max_len) { out->clipped = true; break; }
     }
-    sml_len = new_len;
+    off += wc_l;
+    w += dw;
+    if (dw) { end = off; }
   }
-  if (sctml_len == -1) { sctml_len = sml_len; }
-
-  *out_sml_len = sml_len;
-  if (out_sctml_len) { *out_sctml_len = sctml_len; }
+  if (out->ct_len == -1) { out->ct_len = w; out->ct_end = end; }
+  out->len = w;
+  out->end = end;
+  out->off = off;
   return true;
 }
 
+// One backward pass from the end of str: the visible tail starts at the leftmost glyph whose
+// successors are narrower than len, and ends where its width, read forward, first reaches len.
+// Returns the start's byte offset and sets *out_end, or returns -1 on a control character.
+static int imp__str_tail(unsigned char const *str, int str_bytes, int len, int *out_end) {
+  int w = 0, start = str_bytes;
+  int ends[2] = { str_bytes, str_bytes }; // the end if the tail is len + i wide
+  while ((start > 0) && (w < len)) {
+    int cp_start = start - 1;
+    while ((cp_start > 0) && ((str[cp_start] & 0xc0) == 0x80) && ((start - cp_start) < 4)) {
+      --cp_start;
+    }
+    uint32_t wc;
+    imp_util__wchar_from_utf8_n(&str[cp_start], (size_t)(start - cp_start), &wc);
+    int const dw = imp_util__wchar_display_width(wc);
+    if (dw < 0) { return -1; }
+    w += dw;
+    start = cp_start;
+    if (w <= 1) { ends[1] = start; }
+    if (w == 0) { ends[0] = start; }
+  }
+  // A wide leftmost glyph overshoots len by at most 1; a whole string narrower than len ends
+  // at its last byte.
+  *out_end = (w < len) ? str_bytes : ends[imp__min(w - len, 1)];
+  return start;
+}
+
+// STRING values end at their NUL, STRING_SPAN values after len bytes; *out_n is INT_MAX for
+// the former. Returns false if there's no string.
+// Only STRING + STRING_SPAN values carry text; the payload of any other type is ignored.
+static bool imp__value_str(imp_value_t const *v, char const **out_s, int *out_n) {
+  if (!v) { return false; }
+  if (v->type == IMP_VALUE_TYPE_STRING_SPAN) {
+    *out_s = v->v.sp.data;
+    *out_n = (v->v.sp.len < (size_t)INT_MAX) ? (int)v->v.sp.len : INT_MAX;
+  } else if (v->type == IMP_VALUE_TYPE_STRING) {
+    *out_s = v->v.s;
+    *out_n = INT_MAX;
+  } else {
+    return false;
+  }
+  return *out_s != NULL;
+}
+
 static int imp__string_write(imp_ctx_t *ctx,
                              imp_widget_string_t const *s,
                              imp_value_t const *v) {
-  bool const have_v = v && v->v.s;
-  bool const have_ct = (s->custom_trim != NULL);
+  char const *str_s = NULL;
+  int str_n = 0;
+  bool const have_v = imp__value_str(v, &str_s, &str_n);
+  bool const is_span = have_v && (v->type == IMP_VALUE_TYPE_STRING_SPAN);
 
-  // s = string, fwp = field width pad, ml = max length, ct = custom trim
-  int const s_len = have_v ? imp_util_get_display_width(v->v.s) : 0;
-  int const ct_len = have_ct ? imp_util_get_display_width(s->custom_trim) : 0;
+  // ct = custom trim, fwp = field width pad
+  int const ct_len = s->custom_trim ? imp__const_width(ctx, s->custom_trim) : 0;
 
-  int sml_len = s_len, sctml_len = s_len;
-  if (have_v && (s->max_len != -1)) {
-    if (!imp__clipped_str_len(v->v.s, s->max_len, ct_len, &sml_len, &sctml_len)) {
+  imp__str_clip_t c = {
+    .len = 0, .ct_len = 0, .end = 0, .ct_end = 0, .off = 0, .clipped = false
+  };
+  if (have_v) {
+    if (s->max_len == -1) {
+      c.len = imp_util__display_width_n(str_s, (size_t)str_n);
+    } else if (!imp__str_clip(str_s, str_n, s->max_len, ct_len, &c)) {
       return -1;
     }
   }
 
-  bool const need_ct = have_ct && ct_len && (sml_len < s_len) && (sml_len > ct_len);
-  bool const need_ltrim = (sml_len < s_len) && s->trim_left;
+  bool const need_ct = c.clipped && ct_len && (c.len > ct_len);
   int const fwp_len = (s->field_width != -1) ?
-    imp__max(0, s->field_width - (need_ct ? (sctml_len + ct_len) : sml_len)) : 0;
+    imp__max(0, s->field_width - (need_ct ? (c.ct_len + ct_len) : c.len)) : 0;
 
-  for (int i = 0; i < fwp_len; ++i) { imp__print(ctx, " ", NULL); }
+  imp__print_run(ctx, " ", fwp_len);
   if (!have_v) { return fwp_len; }
 
-  if (sml_len == s_len) { // No trim, string fits in len
-    imp__print(ctx, v->v.s, NULL);
-    return fwp_len + s_len;
-  }
-
-  int const len = need_ct ? sctml_len : sml_len;
-
-  unsigned char const *cur = (unsigned char const *)v->v.s;
-  if (need_ltrim) { // ltrim pre-advances through string
-    if (need_ct) { imp__print(ctx, s->custom_trim, NULL); }
-    int i = 0;
-    while (*cur) {
-      uint32_t wc;
-      int const wc_l = imp_util__wchar_from_utf8(cur, &wc);
-      int const wc_w = imp_util__wchar_display_width(wc);
-      if (wc_w < 0) { return -1; }
-      if (s_len - (i + wc_w) < len) { break; }
-      i += wc_w;
-      cur += wc_l;
+  if (!c.clipped) { // string fits in len
+    if (is_span) {
+      imp__print_n(ctx, str_s, str_n, false);
+    } else {
+      imp__print(ctx, str_s, NULL);
     }
+    return fwp_len + c.len;
   }
 
-  for (int i = 0; i < len; ) {
-    char cp[5];
-    int const cp_len = imp_util__wchar_from_utf8(cur, NULL);
-    for (int cpi = 0; cpi < cp_len; ++cpi) { cp[cpi] = (char)cur[cpi]; }
-    cp[cp_len] = '\0';
-    imp__print(ctx, cp, &i);
-    cur += cp_len;
+  if (!s->trim_left) {
+    imp__print_n(ctx, str_s, need_ct ? c.ct_end : c.end, false);
+    if (need_ct) { imp__print_const(ctx, s->custom_trim, NULL); }
+    return fwp_len + c.len;
   }
 
-  if (need_ct && !s->trim_left) { imp__print(ctx, s->custom_trim, NULL); }
-  return sml_len + fwp_len;
+  // The clip read str up to c.off, so only a NUL-terminated string's rest needs scanning.
+  int const len = need_ct ? c.ct_len : c.len;
+  int const str_bytes = is_span ? str_n : (c.off + (int)strlen(&str_s[c.off]));
+  int end;
+  int const start = imp__str_tail((unsigned char const *)str_s, str_bytes, len, &end);
+  if (start < 0) { return -1; }
+
+  if (need_ct) { imp__print_const(ctx, s->custom_trim, NULL); }
+  imp__print_n(ctx, &str_s[start], end - start, !is_span && (end == str_bytes));
+  return fwp_len + c.len;
 }
 
 static int imp__progress_percent_write(imp_widget_progress_percent_t const *p,
-                                       float progress,
+                                       imp_fraction_t progress,
                                        char *out_buf,
                                        unsigned buf_len) {
-  double const p_pct = (double)(progress * 100.f);
   bool const have_fw = (p->field_width >= 0);
   bool const have_pr = (p->precision >= 0);
   int const fw = imp__max(0, p->field_width - 1);
   int const pr = p->precision;
+#ifdef IMP_FIXED_POINT
+  return imp__fixed_write(
+    have_fw ? fw : 0, have_pr ? pr : -1, progress * 100, 32, "%", out_buf, buf_len);
+#else
+  double const p_pct = (double)(progress * 100.f);
 
   if (!have_fw && !have_pr) { return snprintf(out_buf, buf_len, "%f%%", p_pct); }
   if (!have_fw && have_pr) { return snprintf(out_buf, buf_len, "%.*f%%", pr, p_pct); }
   if (have_fw && !have_pr) { return snprintf(out_buf, buf_len, "%*f%%", fw, p_pct); }
   return snprintf(out_buf, buf_len, "%*.*f%%", fw, pr, p_pct);
+#endif
 }
 
 static int imp__progress_fraction_write(imp_widget_progress_fraction_t const *f,
                                         imp_value_t const *prog_cur,
                                         imp_value_t const *prog_max,
+                                        int frac_shift,
                                         char *out_buf,
                                         unsigned buf_len) {
-  int const fw = f->field_width, prec = f->precision;
+  int const fw = f->field_width, prec = f->precision, fs = frac_shift;
   imp_unit_t const u = f->unit;
-  int const num_len = imp__value_write(-1, prec, u, prog_cur, NULL, 0);
-  int const den_len = imp__value_write(-1, prec, u, prog_max, NULL, 0);
+  int const num_len = imp__value_write(-1, prec, u, prog_cur, fs, NULL, 0);
+  int const den_len = imp__value_write(-1, prec, u, prog_max, fs, NULL, 0);
   if ((num_len == -1) || (den_len == -1)) { return -1; }
 
   int const frac_len = num_len + den_len + 1;
@@ -339,210 +784,650 @@ static int imp__progress_fraction_write(imp_widget_progress_fraction_t const *f,
   if (buf_len) {
     int off = 0;
     for (; off < imp__min((int)buf_len, fw_pad); ++off) { out_buf[off] = ' '; }
-    off += imp__value_write(-1, prec, u, prog_cur, &out_buf[off], buf_len - (unsigned)off);
+    off += imp__value_write(-1, prec, u, prog_cur, fs, &out_buf[off], buf_len - (unsigned)off);
     if (off < (int)buf_len) { out_buf[off++] = '/'; }
-    off += imp__value_write(-1, prec, u, prog_max, &out_buf[off], buf_len - (unsigned)off);
+    off += imp__value_write(-1, prec, u, prog_max, fs, &out_buf[off], buf_len - (unsigned)off);
   }
 
   return ttl_len;
 }
 
-static int imp_widget_display_width(imp_widget_def_t const *w,
-                                    imp_value_t const *v,
-                                    float prog_pct,
-                                    imp_value_t const *prog_cur,
-                                    imp_value_t const *prog_max) {
+// Containers hold their sub-widgets as an array: a composite its widgets, a progress bar its
+// edge fill and a ping-pong bar its bouncer.
+static int imp__widget_children(imp_widget_def_t const *w, imp_widget_def_t const **out) {
+  switch (w->type) {
+    case IMP_WIDGET_TYPE_COMPOSITE:
+      *out = w->w.composite.widgets;
+      return w->w.composite.widget_count;
+    case IMP_WIDGET_TYPE_PROGRESS_BAR:
+      *out = w->w.progress_bar.edge_fill;
+      return *out ? 1 : 0;
+    case IMP_WIDGET_TYPE_PING_PONG_BAR:
+      *out = w->w.ping_pong_bar.bouncer;
+      return *out ? 1 : 0;
+    case IMP_WIDGET_TYPE_LABEL:
+    case IMP_WIDGET_TYPE_PROGRESS_FRACTION:
+    case IMP_WIDGET_TYPE_PROGRESS_LABEL:
+    case IMP_WIDGET_TYPE_PROGRESS_PERCENT:
+    case IMP_WIDGET_TYPE_PROGRESS_SCALAR:
+    case IMP_WIDGET_TYPE_SCALAR:
+    case IMP_WIDGET_TYPE_SPARKLINE:
+    case IMP_WIDGET_TYPE_SPINNER:
+    case IMP_WIDGET_TYPE_STACKED_BAR:
+    case IMP_WIDGET_TYPE_STRING:
+    default: break;
+  }
+  *out = NULL;
+  return 0;
+}
+
+typedef struct imp__walk_frame {
+  imp_widget_def_t const *widgets;
+  int16_t count, next;
+} imp__walk_frame_t;
+
+typedef imp_ret_t (*imp__visit_cb_t)(imp_ctx_t *ctx, imp_widget_def_t const *w);
+
+// Pre-order walk of w's tree, calling visit (if any) on each widget. Fails once nesting
+// exceeds IMP_MAX_WIDGET_DEPTH, so the walk itself never needs more stack than that.
+static imp_ret_t imp__widget_walk(imp_ctx_t *ctx,
+                                  imp_widget_def_t const *w,
+                                  imp__visit_cb_t visit,
+                                  int *out_depth) {
+  imp__walk_frame_t stack[IMP_MAX_WIDGET_DEPTH];
+  stack[0] = (imp__walk_frame_t){ .widgets = w, .count = 1, .next = 0 };
+  int sp = 1, depth = 1;
+  while (sp) {
+    imp__walk_frame_t *f = &stack[sp - 1];
+    if (f->next >= f->count) { --sp; continue; }
+    imp_widget_def_t const *cur = imp__child(ctx, f->widgets, f->next++, IMP__DEF_DRAWN);
+    if (visit) {
+      imp_ret_t const ret = visit(ctx, cur);
+      if (ret != IMP_RET_SUCCESS) { return ret; }
+    }
+    imp_widget_def_t const *children;
+    int const n = imp__widget_children(cur, &children);
+    if (n <= 0) { continue; }
+    if (sp == IMP_MAX_WIDGET_DEPTH) { return IMP_RET_ERR_TOO_DEEP; }
+    stack[sp++] = (imp__walk_frame_t){ .widgets = children, .count = (int16_t)n, .next = 0 };
+    depth = imp__max(depth, sp);
+  }
+  if (out_depth) { *out_depth = depth; }
+  return IMP_RET_SUCCESS;
+}
+
+imp_ret_t imp_widget_depth(imp_widget_def_t const *widget, int *out_depth) {
+  if (!widget || !out_depth) { return IMP_RET_ERR_ARGS; }
+  return imp__widget_walk(NULL, widget, NULL, out_depth);
+}
+
+// floor(part * w / whole) for 0 <= part <= whole, without overflowing.
+static int imp__scale_cells(uint64_t part, uint64_t whole, int w) {
+  if (!whole || (w <= 0)) { return 0; }
+  while (whole >= (UINT64_C(1) << 47)) { part >>= 1; whole >>= 1; } // w < 2^16
+  return (int)((part * (uint64_t)w) / whole);
+}
+
+static imp_history_slot_t const *imp__history_at(imp_history_t const *h, uint32_t seq) {
+  return &h->slots[seq & h->mask];
+}
+
+imp_ret_t imp_history_init(imp_history_t *h, imp_history_slot_t *slots, uint32_t capacity) {
+  if (!h || !slots || !capacity || (capacity & (capacity - 1u))) { return IMP_RET_ERR_ARGS; }
+  *h = (imp_history_t){ .slots = slots, .mask = capacity - 1u, .count = 0, .len = 0,
+    .min_head = 0, .min_tail = 0, .max_head = 0, .max_tail = 0 };
+  return IMP_RET_SUCCESS;
+}
+
+void imp_history_push(imp_history_t *h, int64_t sample) {
+  if (!h || !h->slots) { return; }
+  imp_history_slot_t *const s = h->slots;
+  uint32_t const m = h->mask, seq = h->count++;
+
+  // The sample leaving the window goes first (at most one per push), before its slot is reused.
+  if ((h->min_head != h->min_tail) && ((seq - s[h->min_head & m].min_seq) > m)) { ++h->min_head; }
+  if ((h->max_head != h->max_tail) && ((seq - s[h->max_head & m].max_seq) > m)) { ++h->max_head; }
+  s[seq & m].sample = sample;
+
+  // Queued samples the new one dominates can never be the window's minimum (maximum) again.
+  while ((h->min_tail != h->min_head) &&
+         (imp__history_at(h, s[(h->min_tail - 1u) & m].min_seq)->sample >= sample)) {
+    --h->min_tail;
+  }
+  while ((h->max_tail != h->max_head) &&
+         (imp__history_at(h, s[(h->max_tail - 1u) & m].max_seq)->sample <= sample)) {
+    --h->max_tail;
+  }
+  s[h->min_tail++ & m].min_seq = seq;
+  s[h->max_tail++ & m].max_seq = seq;
+  if (h->len <= m) { ++h->len; }
+}
+
+bool imp_history_range(imp_history_t const *h, int64_t *out_min, int64_t *out_max) {
+  if (!h || !h->len) { return false; }
+  if (out_min) { *out_min = imp__history_at(h, h->slots[h->min_head & h->mask].min_seq)->sample; }
+  if (out_max) { *out_max = imp__history_at(h, h->slots[h->max_head & h->mask].max_seq)->sample; }
+  return true;
+}
+
+static bool imp__value_is_history(imp_value_t const *v) {
+  return v && (v->type == IMP_VALUE_TYPE_HISTORY) && v->v.h;
+}
+
+static int imp__sparkline_width(imp_widget_sparkline_t const *s, imp_value_t const *v) {
+  if (s->field_width != -1) { return s->field_width; }
+  if (!imp__value_is_history(v)) { return 0; }
+  return (v->v.h->mask < INT16_MAX) ? (int)v->v.h->mask + 1 : INT16_MAX;
+}
+
+// One pass over the newest samples, oldest first: the ring's range is already current, so
+// each column is scaled as it's staged. Blocks are all 3-byte UTF-8 (E2 96 81-88).
+static imp_ret_t imp__draw_sparkline(imp_ctx_t *ctx,
+                                     imp_widget_sparkline_t const *s,
+                                     imp_value_t const *v,
+                                     int *cx) {
+  if (!ctx->trusted_values && !imp__value_is_history(v)) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
+  imp_history_t const *h = v->v.h;
+  int const cols = imp__max(0, imp__sparkline_width(s, v));
+  int const n = ((uint32_t)cols < h->len) ? cols : (int)h->len;
+  imp__print_run(ctx, " ", cols - n);
+
+  int64_t lo = 0, hi = 0;
+  imp_history_range(h, &lo, &hi);
+  uint64_t const range = (uint64_t)hi - (uint64_t)lo;
+  int const flat_level = (hi > 0) ? 7 : 0;
+  char buf[(3 * 32) + 1];
+  int len = 0;
+  for (uint32_t seq = h->count - (uint32_t)n; seq != h->count; ++seq) {
+    uint64_t const x = (uint64_t)imp__history_at(h, seq)->sample - (uint64_t)lo;
+    int const level = range ? imp__min(imp__scale_cells(x, range, 8), 7) : flat_level;
+    memcpy(&buf[len], "\xe2\x96", 2);
+    buf[len + 2] = (char)(0x81 + level);
+    len += 3;
+    if ((len == (int)sizeof(buf) - 1) || ((seq + 1u) == h->count)) {
+      buf[len] = '\0';
+      imp__print_len(ctx, buf, (size_t)len);
+      len = 0;
+    }
+  }
+  if (cx) { *cx += cols; }
+  return IMP_RET_SUCCESS;
+}
+
+static int imp__leaf_display_width(imp_ctx_t const *ctx,
+                                   imp_widget_def_t const *w,
+                                   imp_value_t const *v,
+                                   imp_fraction_t prog_pct,
+                                   imp_value_t const *prog_cur,
+                                   imp_value_t const *prog_max) {
   switch (w->type) {
-    case IMP_WIDGET_TYPE_LABEL: return imp_util_get_display_width(w->w.label.s);
+    case IMP_WIDGET_TYPE_LABEL: return imp__const_width(ctx, w->w.label.s);
     case IMP_WIDGET_TYPE_SCALAR: return imp__scalar_write(&w->w.scalar, v, NULL, 0);
 
     case IMP_WIDGET_TYPE_STRING: {
       imp_widget_string_t const *s = &w->w.str;
-      int str_len = 0;
-      if (v && v->v.s) {
-        if (!imp__clipped_str_len(v->v.s, s->max_len, 0, &str_len, NULL)) { return false; }
+      imp__str_clip_t c = {
+        .len = 0, .ct_len = 0, .end = 0, .ct_end = 0, .off = 0, .clipped = false
+      };
+      char const *str_s;
+      int str_n;
+      if (imp__value_str(v, &str_s, &str_n) &&
+          !imp__str_clip(str_s, str_n, s->max_len, 0, &c)) {
+        return false;
       }
-      return imp__max(s->field_width, str_len);
+      return imp__max(s->field_width, c.len);
     }
 
     case IMP_WIDGET_TYPE_SPINNER: {
       imp_value_t v_i;
       imp__value_to_int(v, &v_i);
-      return imp_util_get_display_width(imp__spinner_get_string(&w->w.spinner,
-                                                                (unsigned)v_i.v.i));
+      return imp__const_width(ctx, imp__spinner_get_string(ctx, &w->w.spinner,
+                                                            (unsigned)v_i.v.i));
     }
 
     case IMP_WIDGET_TYPE_PROGRESS_FRACTION:
-      return imp__progress_fraction_write(
-        &w->w.progress_fraction, prog_cur, prog_max, NULL, 0);
+      return imp__progress_fraction_write(&w->w.progress_fraction, prog_cur, prog_max,
+                                          imp__progress_frac_shift(ctx), NULL, 0);
 
     case IMP_WIDGET_TYPE_PROGRESS_PERCENT:
       return imp__progress_percent_write(&w->w.progress_percent, prog_pct, NULL, 0);
 
     case IMP_WIDGET_TYPE_PROGRESS_LABEL: {
       imp_widget_progress_label_t const *p = &w->w.progress_label;
-      char const *s = imp__progress_label_get_string(p, prog_pct);
-      int const dw = s ? imp_util_get_display_width(s) : 0;
+      char const *s = imp__progress_label_get_string(ctx, p, prog_pct);
+      int const dw = s ? imp__const_width(ctx, s) : 0;
       return imp__max(p->field_width, dw);
     }
 
     case IMP_WIDGET_TYPE_PROGRESS_SCALAR:
-      return imp__progress_scalar_write(&w->w.progress_scalar, prog_cur, NULL, 0);
+      return imp__progress_scalar_write(&w->w.progress_scalar, prog_cur,
+                                        imp__progress_frac_shift(ctx), NULL, 0);
 
     case IMP_WIDGET_TYPE_PROGRESS_BAR: return w->w.progress_bar.field_width;
     case IMP_WIDGET_TYPE_PING_PONG_BAR: return w->w.ping_pong_bar.field_width;
+    case IMP_WIDGET_TYPE_STACKED_BAR: return w->w.stacked_bar.field_width;
+    case IMP_WIDGET_TYPE_SPARKLINE: return imp__sparkline_width(&w->w.sparkline, v);
+    case IMP_WIDGET_TYPE_COMPOSITE: // handled by imp_widget_display_width
+    default: break;
+  }
+  return 0;
+}
+
+static imp_ret_t imp__composite_check(imp_ctx_t const *ctx,
+                                      imp_widget_def_t const *w,
+                                      imp_value_t const *v) {
+  if (ctx->trusted_values) { return IMP_RET_SUCCESS; }
+  if (!v || (v->type != IMP_VALUE_TYPE_COMPOSITE)) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
+  if (v->v.c.value_count != w->w.composite.widget_count) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
+  return IMP_RET_SUCCESS;
+}
+
+typedef struct imp__width_frame {
+  imp_widget_def_t const *widgets;
+  imp_value_t const *values;
+  int ttl_w;
+  int16_t count, next, max_len;
+} imp__width_frame_t;
 
-    case IMP_WIDGET_TYPE_COMPOSITE: {
-      if (v->type != IMP_VALUE_TYPE_COMPOSITE) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
-      imp_widget_composite_t const *cw = &w->w.composite;
-      imp_value_composite_t const *cv = &v->v.c;
-      if (cv->value_count != cw->widget_count) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
-
-      int ttl_w = 0;
-      for (int i = 0; i < cw->widget_count; ++i) {
-        int const cur_w = imp_widget_display_width(&cw->widgets[i],
-                                                   &cv->values[i],
-                                                   prog_pct,
-                                                   prog_cur,
-                                                   prog_max);
+static int imp_widget_display_width(imp_ctx_t const *ctx,
+                                    imp_widget_def_t const *w,
+                                    imp_value_t const *v,
+                                    imp_fraction_t prog_pct,
+                                    imp_value_t const *prog_cur,
+                                    imp_value_t const *prog_max) {
+  if (w->type != IMP_WIDGET_TYPE_COMPOSITE) {
+    return imp__leaf_display_width(ctx, w, v, prog_pct, prog_cur, prog_max);
+  }
+
+  imp__width_frame_t stack[IMP_MAX_WIDGET_DEPTH];
+  int sp = 0;
+  for (;;) { // w + v are a composite to push
+    imp_ret_t const ret = imp__composite_check(ctx, w, v);
+    if (ret != IMP_RET_SUCCESS) { return ret; }
+    if (sp == IMP_MAX_WIDGET_DEPTH) { return IMP_RET_ERR_TOO_DEEP; }
+    imp_widget_composite_t const *cw = &w->w.composite;
+    stack[sp++] = (imp__width_frame_t){ .widgets = cw->widgets, .values = v->v.c.values,
+      .ttl_w = 0, .count = cw->widget_count, .max_len = cw->max_len };
+
+    for (;;) {
+      imp__width_frame_t *f = &stack[sp - 1];
+      if (f->next < f->count) {
+        w = imp__child(ctx, f->widgets, f->next, IMP__DEF_MEASURED);
+        v = &f->values[f->next++];
+        if (w->type == IMP_WIDGET_TYPE_COMPOSITE) { break; }
+        int const cur_w = imp__leaf_display_width(ctx, w, v, prog_pct, prog_cur, prog_max);
         if (cur_w < 0) { return cur_w; }
-        ttl_w += cur_w;
+        f->ttl_w += cur_w;
+        continue;
       }
-      return cw->max_len < 0 ? ttl_w : imp__min(ttl_w, cw->max_len);
+      int const cw_w = (f->max_len < 0) ? f->ttl_w : imp__min(f->ttl_w, f->max_len);
+      if (--sp == 0) { return cw_w; }
+      stack[sp - 1].ttl_w += cw_w;
     }
-
-    default: break;
   }
-  return 0;
 }
 
-static imp_ret_t imp__draw_widget(imp_ctx_t *ctx,
-                                  float prog_pct,
-                                  imp_value_t const *prog_cur,
-                                  imp_value_t const *prog_max,
-                                  int wi,
-                                  int widget_count,
-                                  imp_widget_def_t const *widgets,
-                                  imp_value_t const *values,
-                                  int *cx) {
-  unsigned const tw = ctx->terminal_width;
-  imp_widget_def_t const *w = &widgets[wi];
-  imp_value_t const *v = &values[wi];
+static imp_ret_t imp__draw_leaf(imp_ctx_t *ctx,
+                                imp_fraction_t prog_pct,
+                                imp_value_t const *prog_cur,
+                                imp_value_t const *prog_max,
+                                imp_widget_def_t const *w,
+                                imp_value_t const *v,
+                                int *cx) {
   char buf[64];
 
   switch (w->type) {
-    case IMP_WIDGET_TYPE_LABEL: imp__print(ctx, w->w.label.s, cx); break;
+    case IMP_WIDGET_TYPE_LABEL: imp__print_const(ctx, w->w.label.s, cx); break;
 
     case IMP_WIDGET_TYPE_STRING: {
-      if (!v || (v->type != IMP_VALUE_TYPE_STRING)) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
+      if (!ctx->trusted_values && (!v || ((v->type != IMP_VALUE_TYPE_STRING) &&
+                                          (v->type != IMP_VALUE_TYPE_STRING_SPAN)))) {
+        return IMP_RET_ERR_WRONG_VALUE_TYPE;
+      }
       int const n = imp__string_write(ctx, &w->w.str, v);
       if (cx) { *cx += n; }
     } break;
 
     case IMP_WIDGET_TYPE_PROGRESS_PERCENT: {
-      imp__progress_percent_write(&w->w.progress_percent, prog_pct, buf, sizeof(buf));
-      imp__print(ctx, buf, cx);
+      int const len =
+        imp__progress_percent_write(&w->w.progress_percent, prog_pct, buf, sizeof(buf));
+      imp__print_fmt(ctx, buf, len, sizeof(buf));
+      if (cx && (len > 0)) { *cx += imp__min(len, (int)sizeof(buf) - 1); }
     } break;
 
     case IMP_WIDGET_TYPE_PROGRESS_LABEL: {
       imp_widget_progress_label_t const *p = &w->w.progress_label;
-      char const *s = imp__progress_label_get_string(p, prog_pct);
-      int const dw = s ? imp_util_get_display_width(s) : 0;
+      char const *s = imp__progress_label_get_string(ctx, p, prog_pct);
+      int const dw = s ? imp__const_width(ctx, s) : 0;
       int const fw_pad = imp__max(0, p->field_width - dw);
-      for (int i = 0; i < fw_pad; ++i) { imp__print(ctx, " ", NULL); }
-      if (s) { imp__print(ctx, s, NULL); }
+      imp__print_run(ctx, " ", fw_pad);
+      imp__print_const(ctx, s, NULL);
       if (cx) { *cx += (dw + fw_pad); }
     } break;
 
-    case IMP_WIDGET_TYPE_PROGRESS_BAR: {
-      imp_widget_progress_bar_t const *pb = &w->w.progress_bar;
-      imp__print(ctx, pb->left_end, cx);
-
-      int bar_w = pb->field_width;
-      if (bar_w == -1) {
-        int rhs = 0;
-        for (int wj = wi + 1; wj < widget_count; ++wj) {
-          imp_widget_def_t const *cur_w = &widgets[wj];
-          int const cur_ww =
-            imp_widget_display_width(cur_w, &values[wj], prog_pct, prog_cur, prog_max);
-          if (cur_ww < 0) { return IMP_RET_ERR_AMBIGUOUS_WIDTH; }
-          rhs += cur_ww;
-        }
-        bar_w = (int)tw - *cx - imp_util_get_display_width(pb->right_end) - rhs;
-      }
-
-      int const edge_w =
-        imp_widget_display_width(pb->edge_fill, v, prog_pct, prog_cur, prog_max);
-      bool const draw_edge = (edge_w <= bar_w) && (prog_pct > 0.f) && (prog_pct < 1.f);
-      int const prog_w = (int)((float)bar_w * prog_pct);
-      int const edge_off = imp__clamp(0, prog_w - (edge_w / 2), bar_w - edge_w);
-      int const full_w = draw_edge ? edge_off : prog_w;
-      int const empty_w = draw_edge ? bar_w - (full_w + edge_w) : (bar_w - full_w);
-
-      for (int fi = 0; fi < full_w; ++fi) { imp__print(ctx, pb->full_fill, NULL); }
-      if (draw_edge) {
-        if (pb->scale_fill) {
-          float const sub_pct =
-            (prog_pct - ((float)full_w * ((float)edge_w / (float)bar_w))) * (float)bar_w;
-          imp__draw_widget(
-            ctx, sub_pct, &(imp_value_t)IMP_VALUE_DOUBLE(sub_pct),
-            &(imp_value_t)IMP_VALUE_DOUBLE(1.), 0, 1, pb->edge_fill, v, NULL);
-        } else {
-          imp__draw_widget(ctx, prog_pct, prog_cur, prog_max, 0, 1, pb->edge_fill, v, NULL);
-        }
-      }
-      for (int ei = 0; ei < empty_w; ++ei) { imp__print(ctx, pb->empty_fill, NULL); }
-
-      if (cx) { *cx += bar_w; }
-      imp__print(ctx, pb->right_end, cx);
-    } break;
-
     case IMP_WIDGET_TYPE_PROGRESS_FRACTION: {
-      int const len = imp__progress_fraction_write(
-        &w->w.progress_fraction, prog_cur, prog_max, buf, sizeof(buf));
+      int const len = imp__progress_fraction_write(&w->w.progress_fraction, prog_cur, prog_max,
+                                                   imp__progress_frac_shift(ctx), buf,
+                                                   sizeof(buf));
       if (len == -1) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
       if (cx) { *cx += len; }
-      imp__print(ctx, buf, NULL);
+      imp__print_fmt(ctx, buf, len, sizeof(buf));
     } break;
 
     case IMP_WIDGET_TYPE_PROGRESS_SCALAR: {
-      int const len =
-        imp__progress_scalar_write(&w->w.progress_scalar, prog_cur, buf, sizeof(buf));
+      int const len = imp__progress_scalar_write(&w->w.progress_scalar, prog_cur,
+                                                 imp__progress_frac_shift(ctx), buf, sizeof(buf));
       if (len == -1) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
       if (cx) { *cx += len; }
-      imp__print(ctx, buf, NULL);
+      imp__print_fmt(ctx, buf, len, sizeof(buf));
     } break;
 
     case IMP_WIDGET_TYPE_SCALAR: {
-      if (!imp__value_type_is_scalar(v)) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
+      if (!ctx->trusted_values && !imp__value_type_is_scalar(v)) {
+        return IMP_RET_ERR_WRONG_VALUE_TYPE;
+      }
       int const len = imp__scalar_write(&w->w.scalar, v, buf, sizeof(buf));
       if (len == -1) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
       if (cx) { *cx += len; }
-      imp__print(ctx, buf, NULL);
+      imp__print_fmt(ctx, buf, len, sizeof(buf));
     } break;
 
     case IMP_WIDGET_TYPE_SPINNER: {
-      if (!imp__value_type_is_scalar(v)) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
+      if (!ctx->trusted_values && !imp__value_type_is_scalar(v)) {
+        return IMP_RET_ERR_WRONG_VALUE_TYPE;
+      }
       imp_value_t v_i;
       imp__value_to_int(v, &v_i);
-      imp__print(ctx, imp__spinner_get_string(&w->w.spinner, (unsigned)v_i.v.i), cx);
+      imp__print_const(ctx, imp__spinner_get_string(ctx, &w->w.spinner, (unsigned)v_i.v.i), cx);
     } break;
 
+    case IMP_WIDGET_TYPE_SPARKLINE: return imp__draw_sparkline(ctx, &w->w.sparkline, v, cx);
+
     case IMP_WIDGET_TYPE_PING_PONG_BAR: break;
+    case IMP_WIDGET_TYPE_PROGRESS_BAR: // handled by imp__draw_widget
+    case IMP_WIDGET_TYPE_STACKED_BAR:
+    case IMP_WIDGET_TYPE_COMPOSITE:
+    default: break;
+  }
 
-    case IMP_WIDGET_TYPE_COMPOSITE: {
-      if (v->type != IMP_VALUE_TYPE_COMPOSITE) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
-      imp_widget_composite_t const *cw = &w->w.composite;
-      imp_value_composite_t const *cv = &v->v.c;
-      if (cw->widget_count != cv->value_count) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
+  return IMP_RET_SUCCESS;
+}
 
-      for (int i = 0; i < cw->widget_count; ++i) {
-        imp__draw_widget(ctx, prog_pct, prog_cur, prog_max, i, cw->widget_count,
-          cw->widgets, cv->values, cx);
+// One level of the draw walk: widgets[next..count) are still to be drawn. A frame pushed for
+// a progress bar's edge fill finishes the bar (empty fill + right end) when it's popped.
+typedef struct imp__draw_frame {
+  imp_widget_def_t const *widgets;
+  imp_value_t const *values;
+  char const *bar_empty_fill, *bar_right_end;
+  imp_fraction_t prog_pct;
+  int16_t count, next;
+  int16_t bar_empty_w;
+  bool bar; // an edge fill: bar_empty_w of bar_empty_fill, then bar_right_end, remain
+  bool scaled; // progress is prog_pct of 1.0, from a scale_fill bar
+  bool count_cx; // false inside edge fills, which don't advance the line's cursor
+} imp__draw_frame_t;
+_Static_assert(sizeof(imp__draw_frame_t) + sizeof(imp__width_frame_t) <=
+                 6 * sizeof(void *) + 2 * sizeof(imp_fraction_t) + 24,
+               "IMP_MAX_WIDGET_DEPTH per-level cost");
+
+// A bar's fill width: field_width, or if that's -1, what's left of the line after the bar's
+// right end and the widgets following it in f. False if one of those has no fixed width.
+static bool imp__bar_width(imp_ctx_t const *ctx,
+                           imp__draw_frame_t const *f,
+                           int wi,
+                           int field_width,
+                           char const *right_end,
+                           imp_value_t const *prog_cur,
+                           imp_value_t const *prog_max,
+                           int const *cx,
+                           int *out_w) {
+  if (field_width != -1) { *out_w = field_width; return true; }
+  int rhs = 0;
+  for (int wj = wi + 1; wj < f->count; ++wj) {
+    int const cur_ww =
+      imp_widget_display_width(ctx, imp__child(ctx, f->widgets, wj, IMP__DEF_MEASURED),
+                               &f->values[wj], f->prog_pct, prog_cur, prog_max);
+    if (cur_ww < 0) { return false; }
+    rhs += cur_ww;
+  }
+  *out_w = (int)ctx->terminal_width - (cx ? *cx : 0) - imp__const_width(ctx, right_end) - rhs;
+  return true;
+}
+
+static uint64_t imp__count(imp_value_t const *v) {
+  imp_value_t c;
+  return (imp__value_to_int(v, &c) && (c.v.i > 0)) ? (uint64_t)c.v.i : 0;
+}
+
+// Stacked bars are drawn in one pass: each segment's cells end where its running total of
+// counts falls, so rounding never moves the bar's total, and each segment is a single run.
+static imp_ret_t imp__draw_stacked_bar(imp_ctx_t *ctx,
+                                       imp__draw_frame_t const *f,
+                                       int wi,
+                                       imp_widget_def_t const *w,
+                                       imp_value_t const *prog_cur,
+                                       imp_value_t const *prog_max,
+                                       int *cx) {
+  imp_widget_stacked_bar_t const *sb = &w->w.stacked_bar;
+  imp_value_t const *v = f->values ? &f->values[wi] : NULL;
+  if (!ctx->trusted_values) {
+    if (!v || (v->type != IMP_VALUE_TYPE_COMPOSITE) ||
+        (v->v.c.value_count != sb->segment_count)) {
+      return IMP_RET_ERR_WRONG_VALUE_TYPE;
+    }
+    for (int si = 0; si < sb->segment_count; ++si) {
+      if (!imp__value_type_is_scalar(&v->v.c.values[si])) { return IMP_RET_ERR_WRONG_VALUE_TYPE; }
+    }
+  }
+
+  imp__print_const(ctx, sb->left_end, cx);
+  int bar_w;
+  if (!imp__bar_width(ctx, f, wi, sb->field_width, sb->right_end, prog_cur, prog_max, cx,
+                      &bar_w)) {
+    return IMP_RET_ERR_AMBIGUOUS_WIDTH;
+  }
+  bar_w = imp__max(0, bar_w);
+
+  uint64_t whole = prog_max ? imp__count(prog_max) : 0;
+  if (!whole) { // no progress, or a max of 0: scale to the counts' sum instead
+    for (int si = 0; si < sb->segment_count; ++si) {
+      uint64_t const n = imp__count(&v->v.c.values[si]);
+      whole = ((UINT64_MAX - whole) < n) ? UINT64_MAX : (whole + n);
+    }
+  }
+
+  uint64_t run_total = 0;
+  int cells = 0;
+  bool colored = false;
+  for (int si = 0; si < sb->segment_count; ++si) {
+    uint64_t const n = imp__count(&v->v.c.values[si]);
+    run_total = ((whole - run_total) < n) ? whole : (run_total + n);
+    int const end = imp__scale_cells(run_total, whole, bar_w);
+    if (end == cells) { continue; }
+    imp_widget_stacked_bar_segment_t const seg = imp__stacked_bar_segment(ctx, sb, si);
+    if (seg.color) {
+      imp__print(ctx, seg.color, NULL);
+      colored = true;
+    } else if (colored) {
+      IMP__PRINT_LIT(ctx, IMP_COLOR_RESET);
+      colored = false;
+    }
+    imp__print_run(ctx, seg.fill, end - cells);
+    cells = end;
+  }
+  if (colored) { IMP__PRINT_LIT(ctx, IMP_COLOR_RESET); }
+  imp__print_run(ctx, sb->empty_fill, bar_w - cells);
+  if (cx) { *cx += bar_w; }
+  imp__print_const(ctx, sb->right_end, cx);
+  return IMP_RET_SUCCESS;
+}
+
+// Draws a progress bar up to its edge fill. Returns true with *out_edge filled in if the
+// edge fill needs drawing, else finishes the bar and returns false.
+static bool imp__draw_bar_start(imp_ctx_t *ctx,
+                                imp__draw_frame_t const *f,
+                                int wi,
+                                imp_widget_def_t const *w,
+                                imp_value_t const *prog_cur,
+                                imp_value_t const *prog_max,
+                                int *cx,
+                                imp_ret_t *out_ret,
+                                imp__draw_frame_t *out_edge) {
+  imp_widget_progress_bar_t const *pb = &w->w.progress_bar;
+  imp_value_t const *v = f->values ? &f->values[wi] : NULL;
+  imp_fraction_t const prog_pct = f->prog_pct;
+  imp__print_const(ctx, pb->left_end, cx);
+
+  int bar_w;
+  if (!imp__bar_width(ctx, f, wi, pb->field_width, pb->right_end, prog_cur, prog_max, cx,
+                      &bar_w)) {
+    *out_ret = IMP_RET_ERR_AMBIGUOUS_WIDTH;
+    return false;
+  }
+
+  int const edge_w =
+    imp_widget_display_width(ctx, imp__child(ctx, pb->edge_fill, 0, IMP__DEF_MEASURED), v,
+                             prog_pct, prog_cur, prog_max);
+  bool const draw_edge = (edge_w <= bar_w) && (prog_pct > 0) && (prog_pct < IMP_FRACTION_ONE);
+#ifdef IMP_FIXED_POINT
+  int const prog_w = (int)((bar_w * prog_pct) / IMP_FRACTION_ONE);
+#else
+  int const prog_w = (int)((float)bar_w * prog_pct);
+#endif
+  int const edge_off = imp__clamp(0, prog_w - (edge_w / 2), bar_w - edge_w);
+  int const full_w = draw_edge ? edge_off : prog_w;
+  int const empty_w = draw_edge ? bar_w - (full_w + edge_w) : (bar_w - full_w);
+
+  imp__print_run(ctx, pb->full_fill, full_w);
+  if (cx) { *cx += bar_w; }
+  if (!draw_edge) {
+    imp__print_run(ctx, pb->empty_fill, empty_w);
+    imp__print_const(ctx, pb->right_end, cx);
+    return false;
+  }
+
+  *out_edge = (imp__draw_frame_t){ .widgets = pb->edge_fill,
+                                   .values = v,
+                                   .bar_empty_fill = pb->empty_fill,
+                                   .bar_right_end = pb->right_end,
+                                   .bar = true,
+                                   .prog_pct = prog_pct,
+                                   .count = 1,
+                                   .bar_empty_w = (int16_t)empty_w,
+                                   .scaled = f->scaled,
+                                   .count_cx = false };
+  if (pb->scale_fill) {
+#ifdef IMP_FIXED_POINT
+    out_edge->prog_pct = (prog_pct * bar_w) - ((imp_fraction_t)(full_w * edge_w) << 32);
+#else
+    out_edge->prog_pct =
+      (prog_pct - ((float)full_w * ((float)edge_w / (float)bar_w))) * (float)bar_w;
+#endif
+    out_edge->scaled = true;
+  }
+  return true;
+}
+
+// Iterative pre-order draw with a fixed IMP_MAX_WIDGET_DEPTH frame stack. As with the
+// recursive renderer it replaces, only the root widget's errors are reported; a nested
+// widget that fails is left undrawn.
+static imp_ret_t imp__draw_widget(imp_ctx_t *ctx,
+                                  imp_fraction_t prog_pct,
+                                  imp_value_t const *prog_cur,
+                                  imp_value_t const *prog_max,
+                                  imp_widget_def_t const *widget,
+                                  imp_value_t const *value,
+                                  int *cx) {
+  imp__draw_frame_t stack[IMP_MAX_WIDGET_DEPTH];
+  stack[0] = (imp__draw_frame_t){ .widgets = widget,
+                                  .values = value,
+                                  .bar_empty_fill = NULL,
+                                  .bar_right_end = NULL,
+                                  .bar = false,
+                                  .prog_pct = prog_pct,
+                                  .count = 1,
+                                  .scaled = false,
+                                  .count_cx = true };
+  int sp = 1;
+#ifdef IMP_FIXED_POINT
+  imp_value_t const scaled_max = IMP_VALUE_INT(IMP_FRACTION_ONE); // scaled_cur is Q32.32
+#else
+  imp_value_t const scaled_max = IMP_VALUE_DOUBLE(1.);
+#endif
+  imp_value_t scaled_cur;
+
+  while (sp) {
+    imp__draw_frame_t *f = &stack[sp - 1];
+    if (f->next >= f->count) {
+      if (--sp && f->bar) {
+        imp__print_run(ctx, f->bar_empty_fill, f->bar_empty_w);
+        imp__print_const(ctx, f->bar_right_end, stack[sp - 1].count_cx ? cx : NULL);
       }
-    } break;
+      continue;
+    }
 
-    default: break;
+    int const wi = f->next++;
+    imp_widget_def_t const *w = imp__child(ctx, f->widgets, wi, IMP__DEF_DRAWN);
+    imp_value_t const *v = f->values ? &f->values[wi] : NULL;
+    int *const w_cx = f->count_cx ? cx : NULL;
+    imp_value_t const *cur = prog_cur, *max = prog_max;
+#ifdef IMP_FIXED_POINT
+    ctx->progress_q32 = f->scaled;
+#endif
+    if (f->scaled) {
+#ifdef IMP_FIXED_POINT
+      scaled_cur = (imp_value_t)IMP_VALUE_INT(f->prog_pct);
+#else
+      scaled_cur = (imp_value_t)IMP_VALUE_DOUBLE(f->prog_pct);
+#endif
+      cur = &scaled_cur;
+      max = &scaled_max;
+    }
+
+    imp_ret_t ret = IMP_RET_SUCCESS;
+    imp__draw_frame_t child;
+    bool push = false;
+    switch (w->type) {
+      case IMP_WIDGET_TYPE_COMPOSITE:
+        ret = imp__composite_check(ctx, w, v);
+        push = (ret == IMP_RET_SUCCESS);
+        child = (imp__draw_frame_t){ .widgets = w->w.composite.widgets,
+                                     .values = push ? v->v.c.values : NULL,
+                                     .bar_empty_fill = NULL,
+                                     .bar_right_end = NULL,
+                                     .bar = false,
+                                     .prog_pct = f->prog_pct,
+                                     .count = w->w.composite.widget_count,
+                                     .scaled = f->scaled,
+                                     .count_cx = f->count_cx };
+        break;
+
+      case IMP_WIDGET_TYPE_PROGRESS_BAR:
+        push = imp__draw_bar_start(ctx, f, wi, w, cur, max, w_cx, &ret, &child);
+        break;
+
+      case IMP_WIDGET_TYPE_STACKED_BAR:
+        ret = imp__draw_stacked_bar(ctx, f, wi, w, cur, max, w_cx);
+        break;
+
+      case IMP_WIDGET_TYPE_LABEL:
+      case IMP_WIDGET_TYPE_PING_PONG_BAR:
+      case IMP_WIDGET_TYPE_PROGRESS_FRACTION:
+      case IMP_WIDGET_TYPE_PROGRESS_LABEL:
+      case IMP_WIDGET_TYPE_PROGRESS_PERCENT:
+      case IMP_WIDGET_TYPE_PROGRESS_SCALAR:
+      case IMP_WIDGET_TYPE_SCALAR:
+      case IMP_WIDGET_TYPE_SPARKLINE:
+      case IMP_WIDGET_TYPE_SPINNER:
+      case IMP_WIDGET_TYPE_STRING:
+      default: ret = imp__draw_leaf(ctx, f->prog_pct, cur, max, w, v, w_cx); break;
+    }
+
+    if ((ret != IMP_RET_SUCCESS) && (f == stack)) { return ret; }
+    if (push) {
+      if (sp == IMP_MAX_WIDGET_DEPTH) { return IMP_RET_ERR_TOO_DEEP; }
+      stack[sp++] = child;
+    }
   }
 
   return IMP_RET_SUCCESS;
@@ -551,81 +1436,831 @@ static imp_ret_t imp__draw_widget(imp_ctx_t *ctx,
 imp_ret_t imp_init(imp_ctx_t *ctx, imp_print_cb_t print_cb, void *print_cb_ctx) {
   if (!ctx) { return IMP_RET_ERR_ARGS; }
   ctx->print_cb_ctx = print_cb_ctx;
-  ctx->print_cb = print_cb ? print_cb : imp__default_print_cb;
+  ctx->print_cb = print_cb;
+  ctx->write_cb = print_cb ? NULL : imp__default_write_cb;
+  ctx->width_cache = NULL;
+  ctx->width_cache_capacity = 0;
+  ctx->term_caps = 0;
+  ctx->pack = NULL;
+  ctx->pack_defs = NULL;
+  ctx->trusted_values = false;
+  ctx->trusted_depth = false;
+  ctx->progress_q32 = false;
   ctx->terminal_width = 0;
   ctx->cur_frame_line_count = 0;
   ctx->last_frame_line_count = 0;
+  ctx->cursor_row = 0;
+  ctx->screen_rows = 1;
+  ctx->frame_bytes = 0;
+  ctx->cursor_at_line_start = false;
+  ctx->no_skip = false;
+  ctx->begin_line_count = 0;
+  ctx->begin_cursor_row = 0;
+  ctx->begin_screen_rows = 1;
+  ctx->begin_at_line_start = false;
+  return IMP_RET_SUCCESS;
+}
+
+imp_ret_t imp_init_write(imp_ctx_t *ctx, imp_write_cb_t write_cb, void *write_cb_ctx) {
+  imp_ret_t const ret = imp_init(ctx, NULL, write_cb_ctx);
+  if ((ret == IMP_RET_SUCCESS) && write_cb) { ctx->write_cb = write_cb; }
+  return ret;
+}
+
+imp_ret_t imp_set_term_caps(imp_ctx_t *ctx, unsigned caps) {
+  if (!ctx || (caps & ~(unsigned)IMP_TERM_CAP_REP)) { return IMP_RET_ERR_ARGS; }
+  ctx->term_caps = (uint16_t)caps;
+  return IMP_RET_SUCCESS;
+}
+
+imp_ret_t imp_set_width_cache(imp_ctx_t *ctx, imp_width_entry_t *entries, uint16_t capacity) {
+  if (!ctx) { return IMP_RET_ERR_ARGS; }
+  if (entries && (!capacity || (capacity & (capacity - 1u)))) { return IMP_RET_ERR_ARGS; }
+  for (unsigned i = 0; entries && (i < capacity); ++i) {
+    entries[i] = (imp_width_entry_t){ .s = NULL, .dw = 0, .len = 0 };
+  }
+  ctx->width_cache = entries;
+  ctx->width_cache_capacity = entries ? capacity : 0;
+  return IMP_RET_SUCCESS;
+}
+
+static imp_ret_t imp__width_cache_insert(imp_ctx_t *ctx, char const *s) {
+  if (!s) { return IMP_RET_SUCCESS; }
+  unsigned const mask = ctx->width_cache_capacity - 1u;
+  unsigned i = imp__width_cache_slot(ctx, s);
+  for (unsigned n = 0; n <= mask; ++n, i = (i + 1) & mask) {
+    imp_width_entry_t *e = &ctx->width_cache[i];
+    if (e->s == s) { return IMP_RET_SUCCESS; }
+    if (!e->s) {
+      *e = (imp_width_entry_t){
+        .s = s, .dw = (int16_t)imp_util_get_display_width(s), .len = (uint32_t)strlen(s) };
+      return IMP_RET_SUCCESS;
+    }
+  }
+  return IMP_RET_ERR_EXHAUSTED;
+}
+
+static imp_ret_t imp__width_cache_insert_all(imp_ctx_t *ctx, char const *const *ss, int n) {
+  for (int i = 0; i < n; ++i) {
+    imp_ret_t const ret = imp__width_cache_insert(ctx, ss[i]);
+    if (ret != IMP_RET_SUCCESS) { return ret; }
+  }
+  return IMP_RET_SUCCESS;
+}
+
+// Records one widget's own constant strings; imp__widget_walk visits its sub-widgets.
+static imp_ret_t imp__widget_prepare_visit(imp_ctx_t *ctx, imp_widget_def_t const *w) {
+  switch (w->type) {
+    case IMP_WIDGET_TYPE_LABEL: return imp__width_cache_insert(ctx, w->w.label.s);
+    case IMP_WIDGET_TYPE_STRING: return imp__width_cache_insert(ctx, w->w.str.custom_trim);
+
+    case IMP_WIDGET_TYPE_SPINNER:
+      for (unsigned fi = 0; fi < w->w.spinner.frame_count; ++fi) {
+        imp_ret_t const ret =
+          imp__width_cache_insert(ctx, imp__spinner_frame(ctx, &w->w.spinner, fi));
+        if (ret != IMP_RET_SUCCESS) { return ret; }
+      }
+      break;
+
+    case IMP_WIDGET_TYPE_PROGRESS_LABEL: {
+      imp_widget_progress_label_t const *p = &w->w.progress_label;
+      for (int li = 0; li < p->label_count; ++li) {
+        imp_fraction_t threshold;
+        imp_ret_t const ret =
+          imp__width_cache_insert(ctx, imp__progress_label_entry(ctx, p, li, &threshold));
+        if (ret != IMP_RET_SUCCESS) { return ret; }
+      }
+    } break;
+
+    case IMP_WIDGET_TYPE_PROGRESS_BAR: {
+      imp_widget_progress_bar_t const *pb = &w->w.progress_bar;
+      char const *const ss[] = { pb->left_end, pb->right_end, pb->full_fill, pb->empty_fill };
+      return imp__width_cache_insert_all(ctx, ss, 4);
+    }
+
+    case IMP_WIDGET_TYPE_PING_PONG_BAR: {
+      imp_widget_ping_pong_bar_t const *pp = &w->w.ping_pong_bar;
+      char const *const ss[] = { pp->left_end, pp->right_end, pp->fill };
+      return imp__width_cache_insert_all(ctx, ss, 3);
+    }
+
+    case IMP_WIDGET_TYPE_STACKED_BAR: {
+      imp_widget_stacked_bar_t const *sb = &w->w.stacked_bar;
+      char const *const ss[] = { sb->left_end, sb->right_end, sb->empty_fill };
+      imp_ret_t ret = imp__width_cache_insert_all(ctx, ss, 3);
+      for (int si = 0; (ret == IMP_RET_SUCCESS) && (si < sb->segment_count); ++si) {
+        ret = imp__width_cache_insert(ctx, imp__stacked_bar_segment(ctx, sb, si).fill);
+      }
+      return ret;
+    }
+
+    case IMP_WIDGET_TYPE_COMPOSITE:
+    case IMP_WIDGET_TYPE_PROGRESS_FRACTION:
+    case IMP_WIDGET_TYPE_PROGRESS_PERCENT:
+    case IMP_WIDGET_TYPE_PROGRESS_SCALAR:
+    case IMP_WIDGET_TYPE_SCALAR:
+    case IMP_WIDGET_TYPE_SPARKLINE:
+    default: break;
+  }
+  return IMP_RET_SUCCESS;
+}
+
+imp_ret_t imp_widget_prepare(imp_ctx_t *ctx, imp_widget_def_t const *w) {
+  if (!ctx || !ctx->width_cache) { return IMP_RET_ERR_ARGS; }
+  if (!w) { return IMP_RET_SUCCESS; }
+  return imp__widget_walk(ctx, w, imp__widget_prepare_visit, NULL);
+}
+
+// imp_pack_widget's output grows up from buf[0], and a stack of node + string offsets
+// waiting to be listed grows down from buf[cap].
+typedef struct imp__packer {
+  uint8_t *buf;
+  uint32_t len, top;
+  bool full;
+} imp__packer_t;
+
+static uint16_t imp__pack_bytes(imp__packer_t *pk, void const *src, size_t n) {
+  if (pk->full || (n > (pk->top - pk->len)) || ((pk->len + n) > IMP__PACK_NONE)) {
+    pk->full = true;
+    return IMP__PACK_NONE;
+  }
+  uint16_t const off = (uint16_t)pk->len;
+  memcpy(&pk->buf[off], src, n);
+  pk->len += (uint32_t)n;
+  return off;
+}
+
+static void imp__pack_push(imp__packer_t *pk, uint16_t off) {
+  if (pk->full || ((pk->top - pk->len) < 2)) { pk->full = true; return; }
+  pk->top -= 2;
+  imp__pack_put_u16(&pk->buf[pk->top], off);
+}
+
+// Strings are stored once: any earlier bytes of the program that spell s are reused.
+static uint16_t imp__pack_str(imp__packer_t *pk, char const *s) {
+  if (!s) { return IMP__PACK_NONE; }
+  size_t const n = strlen(s) + 1;
+  for (uint32_t off = 0; (off + n) <= pk->len; ++off) {
+    if (!memcmp(&pk->buf[off], s, n)) { return (uint16_t)off; }
+  }
+  return imp__pack_bytes(pk, s, n);
+}
+
+static void imp__pack_align(imp__packer_t *pk) {
+  while (!pk->full && (pk->len % IMP_PACK_ALIGN)) { imp__pack_bytes(pk, "", 1); }
+}
+
+// Lists the n most recently pushed offsets, oldest first, and pops them.
+static uint16_t imp__pack_list(imp__packer_t *pk, int n) {
+  if (n <= 0) { return IMP__PACK_NONE; }
+  imp__pack_align(pk);
+  uint16_t const off = (uint16_t)pk->len;
+  for (int i = n - 1; i >= 0; --i) {
+    imp__pack_bytes(pk, &pk->buf[pk->top + (2u * (unsigned)i)], 2);
+  }
+  pk->top += 2u * (unsigned)n;
+  return pk->full ? IMP__PACK_NONE : off;
+}
+
+static int32_t imp__pack_q30(imp_fraction_t t) {
+#ifdef IMP_FIXED_POINT
+  imp_fraction_t const q = t / 4;
+  return (q > INT32_MAX) ? INT32_MAX : (q < INT32_MIN) ? INT32_MIN : (int32_t)q;
+#else
+  float const q = t * 1073741824.f;
+  return (q >= 2147483648.f) ? INT32_MAX : (q <= -2147483648.f) ? INT32_MIN : (int32_t)q;
+#endif
+}
+
+// Appends w's node, whose kid_count sub-widget nodes are on the stack, and returns its offset.
+static uint16_t imp__pack_node(imp__packer_t *pk, imp_widget_def_t const *w, int kid_count) {
+  uint8_t n[14] = { (uint8_t)w->type };
+  size_t n_len = 1;
+
+  switch (w->type) {
+    case IMP_WIDGET_TYPE_LABEL:
+      imp__pack_put_u16(&n[1], imp__pack_str(pk, w->w.label.s));
+      n_len = 3;
+      break;
+
+    case IMP_WIDGET_TYPE_STRING: {
+      imp_widget_string_t const *s = &w->w.str;
+      n[1] = s->trim_left ? 1 : 0;
+      imp__pack_put_u16(&n[2], (uint16_t)s->field_width);
+      imp__pack_put_u16(&n[4], (uint16_t)s->max_len);
+      imp__pack_put_u16(&n[6], imp__pack_str(pk, s->custom_trim));
+      n_len = 8;
+    } break;
+
+    case IMP_WIDGET_TYPE_SCALAR:
+    case IMP_WIDGET_TYPE_PROGRESS_FRACTION:
+    case IMP_WIDGET_TYPE_PROGRESS_SCALAR: {
+      imp_widget_scalar_t const *s = &w->w.scalar; // layouts match
+      n[1] = (uint8_t)s->unit;
+      imp__pack_put_u16(&n[2], (uint16_t)s->field_width);
+      imp__pack_put_u16(&n[4], (uint16_t)s->precision);
+      n_len = 6;
+    } break;
+
+    case IMP_WIDGET_TYPE_PROGRESS_PERCENT:
+      imp__pack_put_u16(&n[1], (uint16_t)w->w.progress_percent.field_width);
+      imp__pack_put_u16(&n[3], (uint16_t)w->w.progress_percent.precision);
+      n_len = 5;
+      break;
+
+    case IMP_WIDGET_TYPE_SPINNER: {
+      imp_widget_spinner_t const *s = &w->w.spinner;
+      for (int fi = 0; fi < s->frame_count; ++fi) {
+        imp__pack_push(pk, imp__pack_str(pk, s->frames[fi]));
+      }
+      imp__pack_put_u16(&n[1], s->speed_msec);
+      imp__pack_put_u16(&n[3], s->frame_count);
+      imp__pack_put_u16(&n[5], imp__pack_list(pk, s->frame_count));
+      n_len = 7;
+    } break;
+
+    case IMP_WIDGET_TYPE_PROGRESS_LABEL: {
+      imp_widget_progress_label_t const *p = &w->w.progress_label;
+      for (int li = 0; li < p->label_count; ++li) {
+        imp__pack_push(pk, imp__pack_str(pk, p->labels[li].s));
+      }
+      uint16_t list = IMP__PACK_NONE;
+      if (p->label_count > 0) {
+        imp__pack_align(pk);
+        list = (uint16_t)pk->len;
+        for (int li = 0; li < p->label_count; ++li) {
+          uint32_t const q = (uint32_t)imp__pack_q30(p->labels[li].threshold);
+          uint8_t e[IMP__PACK_LABEL_ENTRY_SIZE] = { (uint8_t)q, (uint8_t)(q >> 8),
+            (uint8_t)(q >> 16), (uint8_t)(q >> 24) };
+          memcpy(&e[4], &pk->buf[pk->top + (2u * (unsigned)(p->label_count - 1 - li))], 2);
+          imp__pack_bytes(pk, e, sizeof(e));
+        }
+        pk->top += 2u * (unsigned)p->label_count;
+      }
+      imp__pack_put_u16(&n[1], (uint16_t)p->field_width);
+      imp__pack_put_u16(&n[3], (uint16_t)p->label_count);
+      imp__pack_put_u16(&n[5], list);
+      n_len = 7;
+    } break;
+
+    case IMP_WIDGET_TYPE_PROGRESS_BAR: {
+      imp_widget_progress_bar_t const *pb = &w->w.progress_bar;
+      imp__pack_put_u16(&n[12], imp__pack_list(pk, kid_count));
+      n[1] = pb->scale_fill ? 1 : 0;
+      imp__pack_put_u16(&n[2], (uint16_t)pb->field_width);
+      imp__pack_put_u16(&n[4], imp__pack_str(pk, pb->left_end));
+      imp__pack_put_u16(&n[6], imp__pack_str(pk, pb->right_end));
+      imp__pack_put_u16(&n[8], imp__pack_str(pk, pb->full_fill));
+      imp__pack_put_u16(&n[10], imp__pack_str(pk, pb->empty_fill));
+      n_len = 14;
+    } break;
+
+    case IMP_WIDGET_TYPE_PING_PONG_BAR: {
+      imp_widget_ping_pong_bar_t const *pp = &w->w.ping_pong_bar;
+      imp__pack_put_u16(&n[9], imp__pack_list(pk, kid_count));
+      imp__pack_put_u16(&n[1], (uint16_t)pp->field_width);
+      imp__pack_put_u16(&n[3], imp__pack_str(pk, pp->left_end));
+      imp__pack_put_u16(&n[5], imp__pack_str(pk, pp->right_end));
+      imp__pack_put_u16(&n[7], imp__pack_str(pk, pp->fill));
+      n_len = 11;
+    } break;
+
+    case IMP_WIDGET_TYPE_STACKED_BAR: {
+      imp_widget_stacked_bar_t const *sb = &w->w.stacked_bar;
+      for (int si = 0; si < sb->segment_count; ++si) { // entries are (color, fill) pairs
+        imp__pack_push(pk, imp__pack_str(pk, sb->segments[si].color));
+        imp__pack_push(pk, imp__pack_str(pk, sb->segments[si].fill));
+      }
+      imp__pack_put_u16(&n[1], (uint16_t)sb->field_width);
+      imp__pack_put_u16(&n[3], (uint16_t)sb->segment_count);
+      imp__pack_put_u16(&n[11], imp__pack_list(pk, 2 * sb->segment_count));
+      imp__pack_put_u16(&n[5], imp__pack_str(pk, sb->left_end));
+      imp__pack_put_u16(&n[7], imp__pack_str(pk, sb->right_end));
+      imp__pack_put_u16(&n[9], imp__pack_str(pk, sb->empty_fill));
+      n_len = 13;
+    } break;
+
+    case IMP_WIDGET_TYPE_SPARKLINE:
+      imp__pack_put_u16(&n[1], (uint16_t)w->w.sparkline.field_width);
+      n_len = 3;
+      break;
+
+    case IMP_WIDGET_TYPE_COMPOSITE:
+      imp__pack_put_u16(&n[1], (uint16_t)w->w.composite.max_len);
+      imp__pack_put_u16(&n[3], (uint16_t)w->w.composite.widget_count);
+      imp__pack_put_u16(&n[5], imp__pack_list(pk, kid_count));
+      n_len = 7;
+      break;
+
+    default: break;
+  }
+
+  return imp__pack_bytes(pk, n, n_len);
+}
+
+static imp_ret_t imp__pack_check_visit(imp_ctx_t *ctx, imp_widget_def_t const *w) {
+  (void)ctx;
+  return ((unsigned)w->type > IMP_WIDGET_TYPE_SPARKLINE) ? IMP_RET_ERR_ARGS : IMP_RET_SUCCESS;
+}
+
+imp_ret_t imp_pack_widget(imp_widget_def_t const *widget,
+                          uint8_t *prog,
+                          uint32_t prog_cap,
+                          uint32_t *io_len,
+                          uint16_t *out_node) {
+  if (!widget || !prog || !io_len || !out_node || (*io_len > prog_cap)) {
+    return IMP_RET_ERR_ARGS;
+  }
+  imp_ret_t const ret = imp__widget_walk(NULL, widget, imp__pack_check_visit, NULL);
+  if (ret != IMP_RET_SUCCESS) { return ret; }
+
+  // Post-order, so each node is written once its sub-widgets' offsets are known and nothing
+  // already written (and perhaps shared by a later string) is ever patched.
+  imp__packer_t pk = { .buf = prog, .len = *io_len, .top = prog_cap, .full = false };
+  imp__walk_frame_t stack[IMP_MAX_WIDGET_DEPTH];
+  stack[0] = (imp__walk_frame_t){ .widgets = widget, .count = 1, .next = 0 };
+  int sp = 1;
+  while (!pk.full) {
+    imp__walk_frame_t *f = &stack[sp - 1];
+    if (f->next < f->count) {
+      imp_widget_def_t const *w = &f->widgets[f->next];
+      imp_widget_def_t const *children;
+      int const n = imp__widget_children(w, &children);
+      if (n > 0) { // depth was checked by the walk above
+        stack[sp++] = (imp__walk_frame_t){ .widgets = children, .count = (int16_t)n, .next = 0 };
+        continue;
+      }
+      imp__pack_push(&pk, imp__pack_node(&pk, w, 0));
+      ++f->next;
+      continue;
+    }
+    if (--sp == 0) { break; }
+    imp__walk_frame_t *parent = &stack[sp - 1];
+    imp__pack_push(&pk, imp__pack_node(&pk, &parent->widgets[parent->next++], f->count));
+  }
+  if (pk.full) { return IMP_RET_ERR_EXHAUSTED; }
+
+  *out_node = imp__pack_u16(&prog[pk.top]);
+  *io_len = pk.len;
   return IMP_RET_SUCCESS;
 }
 
+imp_ret_t imp_widget_prepare_packed(imp_ctx_t *ctx, uint8_t const *prog, uint16_t node) {
+  if (!ctx || !prog) { return IMP_RET_ERR_ARGS; }
+  imp__pack_root_t root;
+  imp_widget_def_t defs[IMP__DEF_SLOTS];
+  ctx->pack = prog;
+  ctx->pack_defs = defs;
+  imp_ret_t const ret = imp_widget_prepare(ctx, imp__pack_root(node, &root));
+  ctx->pack = NULL;
+  ctx->pack_defs = NULL;
+  return ret;
+}
+
+// Moves the cursor to the start of frame-relative row, by the shortest of "\r", CPL, CNL
+// and runs of "\n". CUU / CUD / CHA are never shorter, since the target column is always 0.
+// "\n" is the only motion that scrolls, so rows below screen_rows are always reached by it.
+static void imp__move_to_row(imp_ctx_t *ctx, int row) {
+  static char const s_newlines[] = "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n";
+  int const cur = ctx->cursor_row;
+  char cmd[16];
+
+  if (row < cur) {
+    int const len = snprintf(cmd, sizeof(cmd), IMP_PREVLINE, cur - row);
+    imp__print_fmt(ctx, cmd, len, sizeof(cmd));
+  } else if (row == cur) {
+    if (!ctx->cursor_at_line_start) { IMP__PRINT_LIT(ctx, "\r"); }
+  } else {
+    int n = row - cur;
+    int const existing = ((row < ctx->screen_rows) ? row : (ctx->screen_rows - 1)) - cur;
+    if (existing > 0) {
+      int const len = snprintf(cmd, sizeof(cmd), IMP_NEXTLINE, existing);
+      if (len < existing) {
+        imp__print_fmt(ctx, cmd, len, sizeof(cmd));
+        n -= existing;
+      }
+    }
+    for (int const chunk = (int)sizeof(s_newlines) - 1; n > 0; n -= chunk) {
+      int const k = imp__min(n, chunk);
+      imp__print_len(ctx, &s_newlines[chunk - k], (size_t)k);
+    }
+  }
+
+  ctx->cursor_row = (uint16_t)row;
+  ctx->cursor_at_line_start = true;
+  if (row >= ctx->screen_rows) { ctx->screen_rows = (uint16_t)(row + 1); }
+}
+
 imp_ret_t imp_begin(imp_ctx_t *ctx, uint16_t terminal_width) {
   if (!ctx) { return IMP_RET_ERR_ARGS; }
   ctx->terminal_width = terminal_width;
+  ctx->frame_bytes = 0;
 
-  imp__print(ctx, IMP_HIDE_CURSOR IMP_AUTO_WRAP_DISABLE "\r", NULL);
-  if (ctx->cur_frame_line_count > 1) {
-    char cmd[16];
-    snprintf(cmd, sizeof(cmd), IMP_PREVLINE, ctx->cur_frame_line_count - 1);
-    cmd[sizeof(cmd)-1] = 0;
-    imp__print(ctx, cmd, NULL);
-  }
+  // Motion to the first line is planned when it's drawn, so a skipped top line costs nothing.
+  IMP__PRINT_LIT(ctx, IMP_HIDE_CURSOR IMP_AUTO_WRAP_DISABLE);
 
+  ctx->begin_line_count = ctx->cur_frame_line_count;
+  ctx->begin_cursor_row = ctx->cursor_row;
+  ctx->begin_screen_rows = ctx->screen_rows;
+  ctx->begin_at_line_start = ctx->cursor_at_line_start;
   ctx->last_frame_line_count = ctx->cur_frame_line_count;
   ctx->cur_frame_line_count = 0;
   return IMP_RET_SUCCESS;
 }
 
+imp_ret_t imp_skip_line(imp_ctx_t *ctx) {
+  if (!ctx || ctx->no_skip || (ctx->cur_frame_line_count >= ctx->last_frame_line_count)) {
+    return IMP_RET_ERR_ARGS;
+  }
+  ++ctx->cur_frame_line_count;
+  return IMP_RET_SUCCESS;
+}
+
+imp_ret_t imp_retire_lines(imp_ctx_t *ctx) {
+  if (!ctx) { return IMP_RET_ERR_ARGS; }
+  uint16_t const n = ctx->cur_frame_line_count;
+  if (!n) { return IMP_RET_SUCCESS; }
+  imp__move_to_row(ctx, n);
+  ctx->cursor_row = 0;
+  ctx->screen_rows = (uint16_t)(ctx->screen_rows - n);
+  ctx->last_frame_line_count =
+    (ctx->last_frame_line_count > n) ? (uint16_t)(ctx->last_frame_line_count - n) : 0;
+  ctx->cur_frame_line_count = 0;
+  return IMP_RET_SUCCESS;
+}
+
 imp_ret_t imp_end(imp_ctx_t *ctx, bool done) {
   if (!ctx) { return IMP_RET_ERR_ARGS; }
   if (done) {
-    imp__print(
-      ctx, "\n" IMP_ERASE_CURSOR_TO_SCREEN_END IMP_AUTO_WRAP_ENABLE IMP_SHOW_CURSOR, NULL);
+    imp__move_to_row(ctx, ctx->cur_frame_line_count);
+    IMP__PRINT_LIT(ctx, IMP_ERASE_CURSOR_TO_SCREEN_END IMP_AUTO_WRAP_ENABLE IMP_SHOW_CURSOR);
+    // The finished frame is left behind as scrollback; the next one starts below it.
+    ctx->cur_frame_line_count = 0;
+    ctx->cursor_row = 0;
+    ctx->screen_rows = 1;
+    ctx->cursor_at_line_start = true;
   } else {
     if (ctx->cur_frame_line_count < ctx->last_frame_line_count) {
-      imp__print(ctx, "\n" IMP_ERASE_CURSOR_TO_SCREEN_END, NULL);
+      imp__move_to_row(ctx, ctx->cur_frame_line_count);
+      IMP__PRINT_LIT(ctx, IMP_ERASE_CURSOR_TO_SCREEN_END);
       ++ctx->cur_frame_line_count;
+    } else if ((ctx->cursor_row + 1) < ctx->cur_frame_line_count) {
+      // Park on the last line as a full redraw would, so an interrupted frame stays intact.
+      imp__move_to_row(ctx, ctx->cur_frame_line_count - 1);
     }
   }
+  ctx->no_skip = false;
   imp__print(ctx, NULL, NULL);
   return IMP_RET_SUCCESS;
 }
 
+imp_ret_t imp_resync(imp_ctx_t *ctx) {
+  if (!ctx) { return IMP_RET_ERR_ARGS; }
+  ctx->cur_frame_line_count = ctx->begin_line_count;
+  ctx->cursor_row = ctx->begin_cursor_row;
+  ctx->screen_rows = ctx->begin_screen_rows;
+  ctx->cursor_at_line_start = ctx->begin_at_line_start;
+  ctx->no_skip = true;
+  return IMP_RET_SUCCESS;
+}
+
+static bool imp__progress_args_valid(imp_value_t const *prog_cur,
+                                     imp_value_t const *prog_max) {
+  if ((bool)!!prog_max ^ (bool)!!prog_cur) { return false; }
+  if (!prog_cur) { return true; }
+  // Only numbers divide: both INT or both DOUBLE (compiled out with IMP_NO_DOUBLE).
+  return imp__value_type_is_scalar(prog_cur) && (prog_cur->type == prog_max->type);
+}
+
+#ifdef IMP_FIXED_POINT
+// Progress ratio in Q32.32, clamped to [0, 1]. Both terms are shifted down until the
+// denominator fits in 31 bits, so the scaled numerator can't overflow.
+static imp_fraction_t imp__progress_fraction(imp_value_t const *prog_cur,
+                                             imp_value_t const *prog_max) {
+  if (!prog_cur) { return 0; }
+#ifndef IMP_NO_DOUBLE
+  if (prog_cur->type == IMP_VALUE_TYPE_DOUBLE) {
+    double const r = prog_cur->v.d / prog_max->v.d;
+    return (r >= 1.) ? IMP_FRACTION_ONE : (r > 0.) ? IMP_FRACTION(r) : 0;
+  }
+#endif
+  if (prog_cur->v.i >= prog_max->v.i) { return IMP_FRACTION_ONE; }
+  if (prog_cur->v.i <= 0) { return 0; }
+  uint64_t num = (uint64_t)prog_cur->v.i, den = (uint64_t)prog_max->v.i;
+  while (den >> 31) { num >>= 1; den >>= 1; }
+  return (imp_fraction_t)((num << 32) / den);
+}
+#else
+// Splits progress into a numerator + denominator such that num / den, clamped to [0, 1],
+// is the progress ratio. Kept apart from the division so batches can divide in bulk.
+static void imp__progress_terms(imp_value_t const *prog_cur,
+                                imp_value_t const *prog_max,
+                                double *out_num,
+                                double *out_den) {
+  if (!prog_cur) {
+    *out_num = 0.; *out_den = 1.;
+  } else if (prog_cur->type == IMP_VALUE_TYPE_DOUBLE) {
+    *out_num = prog_cur->v.d; *out_den = prog_max->v.d;
+  } else if (prog_cur->v.i >= prog_max->v.i) {
+    *out_num = 1.; *out_den = 1.;
+  } else {
+    *out_num = (double)(float)prog_cur->v.i; *out_den = (double)(float)prog_max->v.i;
+  }
+}
+#endif
+
+// Everything a line emits after the cursor has moved to its start; *cx is its width.
+static imp_ret_t imp__draw_line_content(imp_ctx_t *ctx,
+                                        imp_fraction_t p,
+                                        imp_value_t const *prog_cur,
+                                        imp_value_t const *prog_max,
+                                        imp_widget_def_t const *widget,
+                                        imp_value_t const *value,
+                                        int *cx) {
+  imp_ret_t const ret = imp__draw_widget(ctx, p, prog_cur, prog_max, widget, value, cx);
+  ctx->progress_q32 = false; // the draw walk sets it per widget
+  if (ret != IMP_RET_SUCCESS) { return ret; }
+  if (*cx < (int)ctx->terminal_width) {
+    IMP__PRINT_LIT(ctx, IMP_ERASE_CURSOR_TO_LINE_END);
+  }
+  return IMP_RET_SUCCESS;
+}
+
+static imp_ret_t imp__draw_line(imp_ctx_t *ctx,
+                                imp_fraction_t p,
+                                imp_value_t const *prog_cur,
+                                imp_value_t const *prog_max,
+                                imp_widget_def_t const *widget,
+                                imp_value_t const *value) {
+  if (!widget) { return IMP_RET_ERR_ARGS; }
+  if (!ctx->trusted_values && !ctx->trusted_depth) {
+    imp_ret_t const depth_ret = imp__widget_walk(ctx, widget, NULL, NULL);
+    if (depth_ret != IMP_RET_SUCCESS) { return depth_ret; }
+  }
+
+  imp__move_to_row(ctx, ctx->cur_frame_line_count);
+  ctx->cursor_at_line_start = false;
+
+  int cx = 0;
+  imp_ret_t const ret =
+    imp__draw_line_content(ctx, p, prog_cur, prog_max, widget, value, &cx);
+  if (ret != IMP_RET_SUCCESS) { return ret; }
+  ctx->cursor_at_line_start = !cx;
+
+  ++ctx->cur_frame_line_count;
+  return IMP_RET_SUCCESS;
+}
+
 imp_ret_t imp_draw_line(imp_ctx_t *ctx,
                         imp_value_t const *prog_cur,
                         imp_value_t const *prog_max,
                         imp_widget_def_t const *widget,
                         imp_value_t const *value) {
   if (!ctx) { return IMP_RET_ERR_ARGS; }
-  if ((bool)!!prog_max ^ (bool)!!prog_cur) { return IMP_RET_ERR_ARGS; }
-  if (prog_cur && (prog_cur->type == IMP_VALUE_TYPE_STRING)) { return IMP_RET_ERR_ARGS; }
-  if (prog_cur && (prog_cur->type != prog_max->type)) { return IMP_RET_ERR_ARGS; }
-
-  float p = 0.f;
-  if (prog_cur) {
-    if (prog_cur->type == IMP_VALUE_TYPE_DOUBLE) {
-      p = imp__clampf(0.f, (float)(prog_cur->v.d / prog_max->v.d), 1.f);
-    } else {
-      if (prog_cur->v.i >= prog_max->v.i) {
-        p = 1.f;
-      } else {
-        p = imp__clampf(0.f, (float)prog_cur->v.i / (float)prog_max->v.i, 1.f);
-      }
+  if (!imp__progress_args_valid(prog_cur, prog_max)) { return IMP_RET_ERR_ARGS; }
+
+#ifdef IMP_FIXED_POINT
+  imp_fraction_t const p = imp__progress_fraction(prog_cur, prog_max);
+#else
+  double num, den;
+  imp__progress_terms(prog_cur, prog_max, &num, &den);
+  float const p = imp__clampf(0.f, (float)(num / den), 1.f);
+#endif
+  return imp__draw_line(ctx, p, prog_cur, prog_max, widget, value);
+}
+
+imp_ret_t imp_draw_line_unchecked(imp_ctx_t *ctx,
+                                  imp_value_t const *prog_cur,
+                                  imp_value_t const *prog_max,
+                                  imp_widget_def_t const *widget,
+                                  imp_value_t const *value) {
+  if (!ctx) { return IMP_RET_ERR_ARGS; }
+  ctx->trusted_values = true;
+  imp_ret_t const ret = imp_draw_line(ctx, prog_cur, prog_max, widget, value);
+  ctx->trusted_values = false;
+  return ret;
+}
+
+imp_ret_t imp_draw_line_packed(imp_ctx_t *ctx,
+                               imp_value_t const *prog_cur,
+                               imp_value_t const *prog_max,
+                               uint8_t const *prog,
+                               uint16_t node,
+                               imp_value_t const *value) {
+  if (!ctx || !prog) { return IMP_RET_ERR_ARGS; }
+  imp__pack_root_t root;
+  imp_widget_def_t defs[IMP__DEF_SLOTS];
+  ctx->pack = prog;
+  ctx->pack_defs = defs;
+  imp_ret_t const ret =
+    imp_draw_line(ctx, prog_cur, prog_max, imp__pack_root(node, &root), value);
+  ctx->pack = NULL;
+  ctx->pack_defs = NULL;
+  return ret;
+}
+
+_Static_assert(IMP_DRAW_BATCH > 0, "IMP_DRAW_BATCH");
+
+imp_ret_t imp_draw_lines(imp_ctx_t *ctx,
+                         int line_count,
+                         imp_value_t const *prog_curs,
+                         imp_value_t const *prog_maxs,
+                         imp_widget_def_t const *const *widgets,
+                         imp_value_t const *const *values) {
+  if (!ctx || (line_count < 0) || !widgets || !values) { return IMP_RET_ERR_ARGS; }
+  if ((bool)!!prog_curs ^ (bool)!!prog_maxs) { return IMP_RET_ERR_ARGS; }
+
+  for (int li = 0; prog_curs && (li < line_count); ++li) {
+    if ((prog_curs[li].type != IMP_VALUE_TYPE_NULL) &&
+        !imp__progress_args_valid(&prog_curs[li], &prog_maxs[li])) {
+      return IMP_RET_ERR_ARGS;
     }
   }
 
-  if (ctx->cur_frame_line_count) { imp__print(ctx, "\n", NULL); }
+#ifndef IMP_FIXED_POINT
+  double num[IMP_DRAW_BATCH], den[IMP_DRAW_BATCH];
+#endif
+  imp_fraction_t p[IMP_DRAW_BATCH];
 
-  int cx = 0;
+  for (int base = 0; base < line_count; base += IMP_DRAW_BATCH) {
+    int const n = imp__min(IMP_DRAW_BATCH, line_count - base);
 
-  imp_ret_t const ret =
-    imp__draw_widget(ctx, p, prog_cur, prog_max, 0, 1, widget, value, &cx);
-  if (ret != IMP_RET_SUCCESS) { return ret; }
+    for (int i = 0; i < n; ++i) {
+      bool const have_prog = prog_curs && (prog_curs[base + i].type != IMP_VALUE_TYPE_NULL);
+      imp_value_t const *cur = have_prog ? &prog_curs[base + i] : NULL;
+      imp_value_t const *max = have_prog ? &prog_maxs[base + i] : NULL;
+#ifdef IMP_FIXED_POINT
+      p[i] = imp__progress_fraction(cur, max);
+#else
+      imp__progress_terms(cur, max, &num[i], &den[i]);
+#endif
+    }
+
+#ifndef IMP_FIXED_POINT
+    for (int i = 0; i < n; ++i) { p[i] = imp__clampf(0.f, (float)(num[i] / den[i]), 1.f); }
+#endif
 
-  if (cx < (int)ctx->terminal_width) {
-    imp__print(ctx, IMP_ERASE_CURSOR_TO_LINE_END, NULL);
+    for (int i = 0; i < n; ++i) {
+      int const li = base + i;
+      bool const have_prog = prog_curs && (prog_curs[li].type != IMP_VALUE_TYPE_NULL);
+      imp_ret_t const ret = imp__draw_line(ctx,
+                                           p[i],
+                                           have_prog ? &prog_curs[li] : NULL,
+                                           have_prog ? &prog_maxs[li] : NULL,
+                                           widgets[li],
+                                           values[li]);
+      if (ret != IMP_RET_SUCCESS) { return ret; }
+    }
+  }
+
+  return IMP_RET_SUCCESS;
+}
+
+// Line li's progress, as imp_draw_lines computes it. False if the values are invalid.
+static bool imp__line_progress(imp_value_t const *prog_curs,
+                               imp_value_t const *prog_maxs,
+                               int li,
+                               imp_value_t const **out_cur,
+                               imp_value_t const **out_max,
+                               imp_fraction_t *out_p) {
+  bool const have_prog = prog_curs && (prog_curs[li].type != IMP_VALUE_TYPE_NULL);
+  *out_cur = have_prog ? &prog_curs[li] : NULL;
+  *out_max = have_prog ? &prog_maxs[li] : NULL;
+  if (have_prog && !imp__progress_args_valid(*out_cur, *out_max)) { return false; }
+#ifdef IMP_FIXED_POINT
+  *out_p = imp__progress_fraction(*out_cur, *out_max);
+#else
+  double num, den;
+  imp__progress_terms(*out_cur, *out_max, &num, &den);
+  *out_p = imp__clampf(0.f, (float)(num / den), 1.f);
+#endif
+  return true;
+}
+
+typedef struct imp__par_line {
+  uint32_t start, len; // NUL-terminated bytes at start in the task's slice
+  bool formatted; // false: draw serially, e.g. it failed or didn't fit
+  bool at_line_start; // nothing was drawn
+} imp__par_line_t;
+
+_Static_assert(sizeof(imp__par_line_t) <= IMP_PAR_LINE_OVERHEAD, "IMP_PAR_LINE_OVERHEAD");
+
+typedef struct imp__par_job {
+  imp_ctx_t const *ctx;
+  imp__par_line_t *lines;
+  char *slices;
+  size_t slice_size;
+  int line_count, lines_per_task;
+  imp_value_t const *prog_curs, *prog_maxs;
+  imp_widget_def_t const *const *widgets;
+  imp_value_t const *const *values;
+} imp__par_job_t;
+
+typedef struct imp__par_sink {
+  char *buf;
+  size_t len, cap;
+  bool full;
+} imp__par_sink_t;
+
+static void imp__par_write_cb(void *ctx, char const *data, size_t len) {
+  imp__par_sink_t *sink = (imp__par_sink_t *)ctx;
+  if (!data || sink->full) { return; }
+  if (len >= (sink->cap - sink->len)) { sink->full = true; return; } // keep room for the NUL
+  memcpy(&sink->buf[sink->len], data, len);
+  sink->len += len;
+}
+
+static void imp__par_task(void *task_ctx, int task_idx) {
+  imp__par_job_t const *job = (imp__par_job_t const *)task_ctx;
+  int const first = task_idx * job->lines_per_task;
+  int const last = imp__min(first + job->lines_per_task, job->line_count);
+  imp__par_sink_t sink = { .buf = &job->slices[(size_t)task_idx * job->slice_size], .len = 0,
+    .cap = job->slice_size, .full = (job->slice_size == 0) };
+
+  imp_ctx_t tctx = *job->ctx;
+  tctx.print_cb = NULL;
+  tctx.write_cb = imp__par_write_cb;
+  tctx.print_cb_ctx = &sink;
+
+  bool ok = true;
+  for (int li = first; li < last; ++li) {
+    imp__par_line_t *l = &job->lines[li];
+    l->formatted = false;
+    if (!ok) { continue; } // the serial pass stops at the failure anyway
+
+    imp_value_t const *cur, *max;
+    imp_fraction_t p;
+    imp_widget_def_t const *w = job->widgets[li];
+    ok = imp__line_progress(job->prog_curs, job->prog_maxs, li, &cur, &max, &p) && w &&
+      (tctx.trusted_values || tctx.trusted_depth ||
+       (imp__widget_walk(&tctx, w, NULL, NULL) == IMP_RET_SUCCESS));
+    if (!ok) { continue; }
+
+    size_t const start = sink.len;
+    int cx = 0;
+    ok = (imp__draw_line_content(&tctx, p, cur, max, w, job->values[li], &cx) ==
+          IMP_RET_SUCCESS) && !sink.full;
+    if (!ok) { continue; }
+    sink.buf[sink.len++] = '\0';
+    *l = (imp__par_line_t){ .start = (uint32_t)start, .len = (uint32_t)(sink.len - start - 1u),
+      .formatted = true, .at_line_start = !cx };
+  }
+}
+
+imp_ret_t imp_draw_lines_parallel(imp_ctx_t *ctx,
+                                  imp_par_t const *par,
+                                  int line_count,
+                                  imp_value_t const *prog_curs,
+                                  imp_value_t const *prog_maxs,
+                                  imp_widget_def_t const *const *widgets,
+                                  imp_value_t const *const *values) {
+  if (!ctx || !par || (par->task_count <= 0) || (line_count < 0) || !widgets || !values) {
+    return IMP_RET_ERR_ARGS;
+  }
+  if ((bool)!!prog_curs ^ (bool)!!prog_maxs) { return IMP_RET_ERR_ARGS; }
+  size_t const lines_size = (size_t)line_count * IMP_PAR_LINE_OVERHEAD;
+  if (!par->work || (par->work_size < lines_size)) { return IMP_RET_ERR_ARGS; }
+  if (!line_count) { return IMP_RET_SUCCESS; }
+
+  int const task_count = imp__min(par->task_count, line_count);
+  imp__par_job_t const job = {
+    .ctx = ctx,
+    .lines = (imp__par_line_t *)par->work,
+    .slices = (char *)par->work + lines_size,
+    .slice_size = (par->work_size - lines_size) / (size_t)task_count,
+    .line_count = line_count,
+    .lines_per_task = (line_count + task_count - 1) / task_count,
+    .prog_curs = prog_curs,
+    .prog_maxs = prog_maxs,
+    .widgets = widgets,
+    .values = values,
+  };
+
+  if (par->exec) {
+    par->exec(par->exec_ctx, task_count, imp__par_task, (void *)&job);
+  } else {
+    for (int ti = 0; ti < task_count; ++ti) { imp__par_task((void *)&job, ti); }
+  }
+
+  for (int li = 0; li < line_count; ++li) {
+    imp__par_line_t const *l = &job.lines[li];
+    if (!l->formatted) {
+      imp_value_t const *cur, *max;
+      imp_fraction_t p;
+      if (!imp__line_progress(prog_curs, prog_maxs, li, &cur, &max, &p)) {
+        return IMP_RET_ERR_ARGS;
+      }
+      imp_ret_t const ret = imp__draw_line(ctx, p, cur, max, widgets[li], values[li]);
+      if (ret != IMP_RET_SUCCESS) { return ret; }
+      continue;
+    }
+    imp__move_to_row(ctx, ctx->cur_frame_line_count);
+    char const *s = &job.slices[(size_t)(li / job.lines_per_task) * job.slice_size + l->start];
+    if (l->len) { imp__print_len(ctx, s, l->len); }
+    ctx->cursor_at_line_start = l->at_line_start;
+    ++ctx->cur_frame_line_count;
   }
 
-  ++ctx->cur_frame_line_count;
   return IMP_RET_SUCCESS;
 }
 
@@ -775,11 +2410,12 @@ static int imp_util__wchar_display_width(uint32_t wc) {
   return two_col ? 2 : 1;
 }
 
-static int imp_util__wchar_from_utf8(unsigned char const *s, uint32_t *out_cp) {
-  unsigned char const *src = s;
+// Reads no more than n bytes of s, stopping early at a NUL.
+static int imp_util__wchar_from_utf8_n(unsigned char const *s, size_t n, uint32_t *out_cp) {
+  size_t i = 0;
   uint32_t cp = 0;
-  while (*src) {
-    unsigned char cur = *src;
+  while ((i < n) && s[i]) {
+    unsigned char cur = s[i];
     do {
       if (cur <= 0x7f) { cp = cur; break; }
       if (cur <= 0xbf) { cp = (cp << 6) | (cur & 0x3f); break; }
@@ -788,25 +2424,32 @@ static int imp_util__wchar_from_utf8(unsigned char const *s, uint32_t *out_cp) {
       cp = cur & 0x07;
     } while (0);
 
-    ++src;
+    ++i;
 
-    if (((*src & 0xc0) != 0x80) && (cp <= 0x10ffff)) {
-      if (out_cp) { *out_cp = cp; }
-      break;
-    }
+    if (((i == n) || ((s[i] & 0xc0) != 0x80)) && (cp <= 0x10ffff)) { break; }
   }
-  return (int)((uintptr_t)src - (uintptr_t)s);
+  if (out_cp) { *out_cp = cp; }
+  return (int)i;
 }
 
-int imp_util_get_display_width(char const *utf8_str) {
+static int imp_util__wchar_from_utf8(unsigned char const *s, uint32_t *out_cp) {
+  return imp_util__wchar_from_utf8_n(s, SIZE_MAX, out_cp);
+}
+
+static int imp_util__display_width_n(char const *utf8_str, size_t n) {
   unsigned char const *src = (unsigned char const *)utf8_str;
+  size_t i = 0;
   int w = 0;
-  while (*src) {
-    if (*src <= 0x7f) { ++src; ++w; continue; }
+  while ((i < n) && src[i]) {
+    if (src[i] <= 0x7f) { ++i; ++w; continue; }
     uint32_t wc;
-    src += imp_util__wchar_from_utf8(src, &wc);
+    i += (size_t)imp_util__wchar_from_utf8_n(&src[i], n - i, &wc);
     w += imp_util__wchar_display_width(wc);
   }
   return w;
 }
 
+int imp_util_get_display_width(char const *utf8_str) {
+  return imp_util__display_width_n(utf8_str, SIZE_MAX);
+}
+
@@ -0,0 +1,135 @@
+#include "improg/imptrace.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t imptrace__now_usec(imptrace_t const *trace) {
+  if (trace->clock_cb) { return trace->clock_cb(trace->clock_cb_ctx); }
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return ((uint64_t)ts.tv_sec * 1000000u) + ((uint64_t)ts.tv_nsec / 1000u);
+}
+
+// NULL once the buffer is full.
+static imptrace_event_t *imptrace__push(imptrace_t *trace,
+                                        imptrace_event_type_t type,
+                                        uint16_t line) {
+  if (trace->count == trace->capacity) { ++trace->dropped; return NULL; }
+  imptrace_event_t *e = &trace->events[trace->count++];
+  *e = (imptrace_event_t){ .ts_usec = imptrace__now_usec(trace) - trace->start_usec,
+    .line = line, .parent = IMPTRACE_NO_PARENT, .type = (uint8_t)type };
+  return e;
+}
+
+// Whole percent of max, clamped to [0, 100], without overflowing.
+static int imptrace__pct(int64_t cur, int64_t max) {
+  if (cur >= max) { return 100; }
+  if (cur <= 0) { return 0; }
+  return (int)((cur > (INT64_MAX / 100)) ? (cur / (max / 100)) : ((cur * 100) / max));
+}
+
+imp_ret_t imptrace_init(imptrace_t *trace,
+                        imptrace_event_t *events,
+                        uint32_t capacity,
+                        unsigned milestone_pct,
+                        imptrace_clock_cb_t clock_cb,
+                        void *clock_cb_ctx) {
+  if (!trace || !events || !capacity || (milestone_pct > 100)) { return IMP_RET_ERR_ARGS; }
+  *trace = (imptrace_t){ .events = events, .capacity = capacity,
+    .milestone_pct = (uint8_t)milestone_pct, .clock_cb = clock_cb,
+    .clock_cb_ctx = clock_cb_ctx };
+  trace->start_usec = imptrace__now_usec(trace);
+  return IMP_RET_SUCCESS;
+}
+
+void imptrace_begin(imptrace_t *trace, uint16_t line, uint16_t parent, char const *name) {
+  imptrace_event_t *e = trace ? imptrace__push(trace, IMPTRACE_EVENT_BEGIN, line) : NULL;
+  if (!e) { return; }
+  e->parent = parent;
+  size_t n = name ? strlen(name) : 0;
+  if (n >= IMPTRACE_NAME_MAX) {
+    n = IMPTRACE_NAME_MAX - 1;
+    while (n && (((unsigned char)name[n] & 0xc0) == 0x80)) { --n; }
+  }
+  while (n && ((name[n - 1] == ' ') || (name[n - 1] == ':'))) { --n; }
+  if (n) { memcpy(e->name, name, n); }
+  e->name[n] = '\0';
+}
+
+void imptrace_end(imptrace_t *trace, uint16_t line, int64_t cur, int64_t max) {
+  imptrace_event_t *e = trace ? imptrace__push(trace, IMPTRACE_EVENT_END, line) : NULL;
+  if (!e) { return; }
+  e->cur = cur;
+  e->max = max;
+}
+
+void imptrace_progress(imptrace_t *trace,
+                       uint16_t line,
+                       int64_t old_cur,
+                       int64_t old_max,
+                       int64_t cur,
+                       int64_t max) {
+  if (!trace || !trace->milestone_pct || (max <= 0)) { return; }
+  int const step = trace->milestone_pct;
+  int const old_reached = (old_max > 0) ? (imptrace__pct(old_cur, old_max) / step) : 0;
+  int const reached = imptrace__pct(cur, max) / step;
+  if (reached <= old_reached) { return; }
+  imptrace_event_t *e = imptrace__push(trace, IMPTRACE_EVENT_MILESTONE, line);
+  if (!e) { return; }
+  e->cur = cur;
+  e->max = max;
+  e->pct = (uint8_t)(reached * step);
+}
+
+static void imptrace__write_name(FILE *f, char const *s) {
+  for (; *s; ++s) {
+    unsigned char const c = (unsigned char)*s;
+    if ((c == '"') || (c == '\\')) {
+      fprintf(f, "\\%c", c);
+    } else if (c < 0x20) {
+      fprintf(f, "\\u%04x", c);
+    } else {
+      fputc(c, f);
+    }
+  }
+}
+
+// Timestamps are microseconds, as trace_event expects. tids start at 1: tid 0 reads as
+// "no thread" in some viewers.
+imp_ret_t imptrace_write(imptrace_t const *trace, FILE *f) {
+  if (!trace || !f) { return IMP_RET_ERR_ARGS; }
+  fputs("{\"traceEvents\":[\n"
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"improg\"}}", f);
+  for (uint32_t i = 0; i < trace->count; ++i) {
+    imptrace_event_t const *e = &trace->events[i];
+    unsigned const tid = e->line + 1u;
+    switch ((imptrace_event_type_t)e->type) {
+      case IMPTRACE_EVENT_BEGIN:
+        fputs(",\n{\"name\":\"", f);
+        imptrace__write_name(f, e->name);
+        fprintf(f, "\",\"ph\":\"B\",\"pid\":1,\"tid\":%u,\"ts\":%" PRIu64
+          ",\"args\":{\"line\":%u", tid, e->ts_usec, e->line);
+        if (e->parent != IMPTRACE_NO_PARENT) { fprintf(f, ",\"parent\":%u", e->parent); }
+        fputs("}}", f);
+        break;
+
+      case IMPTRACE_EVENT_END:
+        fprintf(f, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%" PRIu64
+          ",\"args\":{\"cur\":%" PRIi64 ",\"max\":%" PRIi64 "}}", tid, e->ts_usec, e->cur,
+          e->max);
+        break;
+
+      case IMPTRACE_EVENT_MILESTONE:
+        fprintf(f, ",\n{\"name\":\"%u%%\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u,"
+          "\"ts\":%" PRIu64 ",\"args\":{\"cur\":%" PRIi64 ",\"max\":%" PRIi64 "}}", e->pct,
+          tid, e->ts_usec, e->cur, e->max);
+        break;
+
+      default: break;
+    }
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":%" PRIu32
+    "}}\n", trace->dropped);
+  return (fflush(f) || ferror(f)) ? IMP_RET_ERR_SYSTEM : IMP_RET_SUCCESS;
+}
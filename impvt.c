@@ -0,0 +1,350 @@
+#include "improg/impvt.h"
+
+#include <string.h>
+
+enum { IMPVT__GROUND, IMPVT__ESC, IMPVT__CSI };
+
+static impvt_cell_t const s_blank = { .cp = ' ', .fg = 0, .bg = 0, .attrs = 0, .width = 1 };
+
+static bool impvt__cell_eq(impvt_cell_t const *a, impvt_cell_t const *b) {
+  return (a->cp == b->cp) && (a->fg == b->fg) && (a->bg == b->bg) &&
+    (a->attrs == b->attrs) && (a->width == b->width);
+}
+
+static void impvt__set(impvt_t *vt, int row, int col, impvt_cell_t const *c) {
+  impvt_cell_t *dst = &vt->cells[(row * vt->cols) + col];
+  if (impvt__cell_eq(dst, c)) { return; }
+  *dst = *c;
+  ++vt->cells_changed;
+}
+
+// Overwriting either half of a two-column glyph blanks the other half, as terminals do.
+static void impvt__split_wide(impvt_t *vt, int row, int col) {
+  impvt_cell_t const *c = &vt->cells[(row * vt->cols) + col];
+  if ((c->width == 0) && (col > 0)) { impvt__set(vt, row, col - 1, &s_blank); }
+  if ((c->width == 2) && ((col + 1) < vt->cols)) { impvt__set(vt, row, col + 1, &s_blank); }
+}
+
+static void impvt__erase(impvt_t *vt, int row, int col_begin, int col_end) {
+  if (col_begin >= col_end) { return; }
+  impvt__split_wide(vt, row, col_begin);
+  impvt__split_wide(vt, row, col_end - 1);
+  for (int c = col_begin; c < col_end; ++c) { impvt__set(vt, row, c, &s_blank); }
+}
+
+static void impvt__linefeed(impvt_t *vt) {
+  if ((vt->row + 1) < vt->rows) { ++vt->row; return; }
+  for (int r = 0; (r + 1) < vt->rows; ++r) {
+    for (int c = 0; c < vt->cols; ++c) {
+      impvt__set(vt, r, c, &vt->cells[((r + 1) * vt->cols) + c]);
+    }
+  }
+  impvt__erase(vt, vt->rows - 1, 0, vt->cols);
+}
+
+static void impvt__move(impvt_t *vt, int row, int col) {
+  vt->row = (uint16_t)((row < 0) ? 0 : (row >= vt->rows) ? (vt->rows - 1) : row);
+  vt->col = (uint16_t)((col < 0) ? 0 : (col >= vt->cols) ? (vt->cols - 1) : col);
+  vt->wrap_pending = false;
+}
+
+static void impvt__put_glyph(impvt_t *vt, uint32_t cp, int width) {
+  if ((width <= 0) || (width > vt->cols)) { return; } // combining marks occupy no cell
+  if (vt->wrap_pending) {
+    vt->col = 0;
+    impvt__linefeed(vt);
+    vt->wrap_pending = false;
+  }
+  if ((vt->col + width) > vt->cols) {
+    if (vt->auto_wrap) {
+      vt->col = 0;
+      impvt__linefeed(vt);
+    } else {
+      vt->col = (uint16_t)(vt->cols - width); // auto-wrap off: overwrite the last column(s)
+    }
+  }
+
+  int const row = vt->row, col = vt->col;
+  if (width == 2) { impvt__split_wide(vt, row, col + 1); }
+  impvt__split_wide(vt, row, col);
+
+  impvt_cell_t c = vt->pen;
+  c.cp = cp;
+  c.width = (uint8_t)width;
+  impvt__set(vt, row, col, &c);
+  if (width == 2) {
+    c.cp = 0;
+    c.width = 0;
+    impvt__set(vt, row, col + 1, &c);
+  }
+  vt->last_cp = cp;
+
+  if ((col + width) >= vt->cols) {
+    vt->col = (uint16_t)(vt->cols - 1);
+    vt->wrap_pending = vt->auto_wrap;
+  } else {
+    vt->col = (uint16_t)(col + width);
+  }
+}
+
+static int impvt__utf8_encode(uint32_t cp, char *dst) {
+  if (cp < 0x80) { dst[0] = (char)cp; return 1; }
+  if (cp < 0x800) {
+    dst[0] = (char)(0xc0 | (cp >> 6));
+    dst[1] = (char)(0x80 | (cp & 0x3f));
+    return 2;
+  }
+  if (cp < 0x10000) {
+    dst[0] = (char)(0xe0 | (cp >> 12));
+    dst[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+    dst[2] = (char)(0x80 | (cp & 0x3f));
+    return 3;
+  }
+  dst[0] = (char)(0xf0 | (cp >> 18));
+  dst[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+  dst[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+  dst[3] = (char)(0x80 | (cp & 0x3f));
+  return 4;
+}
+
+static void impvt__put_utf8(impvt_t *vt) {
+  unsigned char const *u = (unsigned char const *)vt->utf8;
+  uint32_t cp = u[0] & (0x7fu >> vt->utf8_need);
+  for (int i = 1; i < vt->utf8_need; ++i) { cp = (cp << 6) | (u[i] & 0x3fu); }
+  vt->utf8[vt->utf8_len] = 0;
+  impvt__put_glyph(vt, cp, imp_util_get_display_width(vt->utf8));
+}
+
+static uint16_t impvt__param(impvt_t const *vt, int i, uint16_t dflt) {
+  return ((i < vt->param_count) && vt->params[i]) ? vt->params[i] : dflt;
+}
+
+static void impvt__sgr(impvt_t *vt) {
+  if (!vt->param_count) { vt->pen = s_blank; return; }
+  for (int i = 0; i < vt->param_count; ++i) {
+    unsigned const p = vt->params[i];
+    if (p == 0) {
+      vt->pen = s_blank;
+    } else if (p == 1) {
+      vt->pen.attrs |= IMPVT_ATTR_BOLD;
+    } else if (p == 2) {
+      vt->pen.attrs |= IMPVT_ATTR_DIM;
+    } else if (p == 3) {
+      vt->pen.attrs |= IMPVT_ATTR_ITALIC;
+    } else if (p == 4) {
+      vt->pen.attrs |= IMPVT_ATTR_UNDERLINE;
+    } else if (p == 7) {
+      vt->pen.attrs |= IMPVT_ATTR_REVERSE;
+    } else if (p == 22) {
+      vt->pen.attrs &= (uint8_t)~(IMPVT_ATTR_BOLD | IMPVT_ATTR_DIM);
+    } else if (p == 23) {
+      vt->pen.attrs &= (uint8_t)~IMPVT_ATTR_ITALIC;
+    } else if (p == 24) {
+      vt->pen.attrs &= (uint8_t)~IMPVT_ATTR_UNDERLINE;
+    } else if (p == 27) {
+      vt->pen.attrs &= (uint8_t)~IMPVT_ATTR_REVERSE;
+    } else if ((p >= 30) && (p <= 37)) {
+      vt->pen.fg = (uint16_t)(p - 30 + 1);
+    } else if ((p >= 40) && (p <= 47)) {
+      vt->pen.bg = (uint16_t)(p - 40 + 1);
+    } else if ((p >= 90) && (p <= 97)) {
+      vt->pen.fg = (uint16_t)(p - 90 + 8 + 1);
+    } else if ((p >= 100) && (p <= 107)) {
+      vt->pen.bg = (uint16_t)(p - 100 + 8 + 1);
+    } else if (p == 39) {
+      vt->pen.fg = 0;
+    } else if (p == 49) {
+      vt->pen.bg = 0;
+    } else if ((p == 38) || (p == 48)) {
+      uint16_t *dst = (p == 38) ? &vt->pen.fg : &vt->pen.bg;
+      if (((i + 2) < vt->param_count) && (vt->params[i + 1] == 5)) {
+        *dst = (uint16_t)(((vt->params[i + 2] > 255) ? 255 : vt->params[i + 2]) + 1);
+        i += 2;
+      } else if (((i + 1) < vt->param_count) && (vt->params[i + 1] == 2)) {
+        i += 4; // 24-bit color isn't modeled
+      }
+    }
+  }
+}
+
+static void impvt__csi(impvt_t *vt, char final) {
+  int const n = impvt__param(vt, 0, 1), row = vt->row, col = vt->col;
+  switch (final) {
+    case 'A': impvt__move(vt, row - n, col); break;
+    case 'B': impvt__move(vt, row + n, col); break;
+    case 'C': impvt__move(vt, row, col + n); break;
+    case 'D': impvt__move(vt, row, col - n); break;
+    case 'E': impvt__move(vt, row + n, 0); break;
+    case 'F': impvt__move(vt, row - n, 0); break;
+    case 'G': impvt__move(vt, row, n - 1); break;
+    case 'H': impvt__move(vt, n - 1, impvt__param(vt, 1, 1) - 1); break;
+
+    case 'K': {
+      int const mode = impvt__param(vt, 0, 0);
+      impvt__erase(vt, row, (mode == 0) ? col : 0, (mode == 1) ? (col + 1) : vt->cols);
+    } break;
+
+    case 'J': {
+      int const mode = impvt__param(vt, 0, 0);
+      if (mode == 0) {
+        impvt__erase(vt, row, col, vt->cols);
+        for (int r = row + 1; r < vt->rows; ++r) { impvt__erase(vt, r, 0, vt->cols); }
+      } else if (mode == 1) {
+        for (int r = 0; r < row; ++r) { impvt__erase(vt, r, 0, vt->cols); }
+        impvt__erase(vt, row, 0, col + 1);
+      } else {
+        for (int r = 0; r < vt->rows; ++r) { impvt__erase(vt, r, 0, vt->cols); }
+      }
+    } break;
+
+    case 'm': impvt__sgr(vt); break;
+
+    case 'b':
+      if (vt->last_cp) {
+        char u[5] = { 0 };
+        impvt__utf8_encode(vt->last_cp, u);
+        int const width = imp_util_get_display_width(u);
+        for (int i = 0; i < n; ++i) { impvt__put_glyph(vt, vt->last_cp, width); }
+      }
+      break;
+
+    case 'h':
+    case 'l':
+      if (vt->csi_private) {
+        for (int i = 0; i < vt->param_count; ++i) {
+          if (vt->params[i] == 25) { vt->cursor_visible = (final == 'h'); }
+          if (vt->params[i] == 7) { vt->auto_wrap = (final == 'h'); }
+        }
+      }
+      break;
+
+    default: break;
+  }
+}
+
+static void impvt__ground(impvt_t *vt, unsigned char b) {
+  if (b >= 0x80) {
+    if ((b & 0xc0) == 0x80) { // continuation
+      if (!vt->utf8_need) { return; }
+      vt->utf8[vt->utf8_len++] = (char)b;
+      if (vt->utf8_len == vt->utf8_need) {
+        impvt__put_utf8(vt);
+        vt->utf8_len = vt->utf8_need = 0;
+      }
+      return;
+    }
+    vt->utf8_need = (b >= 0xf0) ? 4 : (b >= 0xe0) ? 3 : 2;
+    vt->utf8[0] = (char)b;
+    vt->utf8_len = 1;
+    return;
+  }
+
+  vt->utf8_len = vt->utf8_need = 0; // a truncated sequence is dropped
+  switch (b) {
+    case 0x1b: vt->state = IMPVT__ESC; break;
+    case '\r': impvt__move(vt, vt->row, 0); break;
+    case '\n':
+      vt->col = 0;
+      vt->wrap_pending = false;
+      impvt__linefeed(vt);
+      break;
+    case '\b': impvt__move(vt, vt->row, vt->col - 1); break;
+    default:
+      if ((b >= 0x20) && (b < 0x7f)) { impvt__put_glyph(vt, b, 1); }
+      break;
+  }
+}
+
+imp_ret_t impvt_init(impvt_t *vt, impvt_cell_t *cells, int rows, int cols) {
+  if (!vt || !cells || (rows <= 0) || (cols <= 0) || (rows > 0xffff) || (cols > 0xffff)) {
+    return IMP_RET_ERR_ARGS;
+  }
+  memset(vt, 0, sizeof(*vt));
+  vt->cells = cells;
+  vt->rows = (uint16_t)rows;
+  vt->cols = (uint16_t)cols;
+  vt->pen = s_blank;
+  vt->auto_wrap = true;
+  vt->cursor_visible = true;
+  for (int i = 0, n = rows * cols; i < n; ++i) { cells[i] = s_blank; }
+  return IMP_RET_SUCCESS;
+}
+
+void impvt_feed(impvt_t *vt, char const *data, size_t len) {
+  if (!vt || !data) { return; }
+  vt->bytes_fed += len;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char const b = (unsigned char)data[i];
+    switch (vt->state) {
+      case IMPVT__ESC:
+        if (b == '[') {
+          vt->state = IMPVT__CSI;
+          vt->csi_private = false;
+          vt->param_count = 0;
+          vt->params[0] = 0;
+        } else {
+          vt->state = IMPVT__GROUND;
+        }
+        break;
+
+      case IMPVT__CSI:
+        if ((b >= '0') && (b <= '9')) {
+          if (!vt->param_count) { vt->param_count = 1; }
+          uint16_t *p = &vt->params[vt->param_count - 1];
+          *p = (uint16_t)((*p > 999) ? 9999 : ((*p * 10) + (b - '0')));
+        } else if (b == ';') {
+          if (!vt->param_count) { vt->param_count = 1; }
+          if (vt->param_count < IMPVT_MAX_PARAMS) { vt->params[vt->param_count++] = 0; }
+        } else if (b == '?') {
+          vt->csi_private = true;
+        } else if ((b >= 0x40) && (b <= 0x7e)) {
+          impvt__csi(vt, (char)b);
+          vt->state = IMPVT__GROUND;
+        }
+        break;
+
+      default: impvt__ground(vt, b); break;
+    }
+  }
+}
+
+void impvt_print_cb(void *vt, char const *s) {
+  if (s) { impvt_feed((impvt_t *)vt, s, strlen(s)); }
+}
+
+void impvt_write_cb(void *vt, char const *data, size_t len) {
+  impvt_feed((impvt_t *)vt, data, len);
+}
+
+bool impvt_equal(impvt_t const *a, impvt_t const *b) {
+  if (!a || !b || (a->rows != b->rows) || (a->cols != b->cols)) { return false; }
+  if ((a->row != b->row) || (a->col != b->col) || (a->auto_wrap != b->auto_wrap) ||
+      (a->cursor_visible != b->cursor_visible)) {
+    return false;
+  }
+  for (int i = 0, n = a->rows * a->cols; i < n; ++i) {
+    if (!impvt__cell_eq(&a->cells[i], &b->cells[i])) { return false; }
+  }
+  return true;
+}
+
+int impvt_row_text(impvt_t const *vt, int row, char *buf, int buf_cap) {
+  if (!vt || !buf || (buf_cap <= 0) || (row < 0) || (row >= vt->rows)) { return -1; }
+  int len = 0, trimmed_len = 0;
+  for (int c = 0; c < vt->cols; ++c) {
+    impvt_cell_t const *cell = &vt->cells[(row * vt->cols) + c];
+    if (!cell->width) { continue; }
+    char u[4];
+    int const n = impvt__utf8_encode(cell->cp, u);
+    // Blanks that don't fit are only counted: they're trimmed unless a glyph follows.
+    if ((len + n) >= buf_cap) {
+      if (cell->cp != ' ') { return -1; }
+    } else {
+      memcpy(&buf[len], u, (size_t)n);
+    }
+    len += n;
+    if (cell->cp != ' ') { trimmed_len = len; }
+  }
+  buf[trimmed_len] = 0;
+  return trimmed_len;
+}
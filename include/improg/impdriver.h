@@ -0,0 +1,50 @@
+// ImpDriver: a pollable frame clock for driving ImProg from an epoll reactor (Linux).
+#ifndef IMPDRIVER_H
+#define IMPDRIVER_H
+
+#include "improg.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Renders one frame: imp_begin, draw lines, imp_end.
+typedef void (*impdrv_render_cb_t)(imp_ctx_t *ctx, void *render_cb_ctx);
+
+// impdrv_fd() is an epoll fd (nestable in the caller's epoll set) watching a timerfd frame
+// clock and an eventfd "dirty" flag. Nothing is armed while idle: marking dirty renders on
+// the next dispatch if the last frame is at least frame_msec old, otherwise arms the timer
+// for the remainder of the frame interval.
+typedef struct impdrv {
+  imp_ctx_t *ctx;
+  impdrv_render_cb_t render_cb;
+  void *render_cb_ctx;
+  uint64_t last_frame_nsec;
+  uint32_t frame_msec;
+  int epoll_fd;
+  int timer_fd;
+  int dirty_fd;
+  bool dirty;
+  bool timer_armed;
+} impdrv_t;
+
+imp_ret_t impdrv_init(impdrv_t *drv,
+                      imp_ctx_t *ctx,
+                      unsigned frame_msec,
+                      impdrv_render_cb_t render_cb,
+                      void *render_cb_ctx);
+void impdrv_destroy(impdrv_t *drv);
+
+int impdrv_fd(impdrv_t const *drv);
+
+// Safe to call from any thread.
+imp_ret_t impdrv_mark_dirty(impdrv_t *drv);
+
+// Call when impdrv_fd() is readable. out_rendered may be NULL.
+imp_ret_t impdrv_dispatch(impdrv_t *drv, bool *out_rendered);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,110 @@
+// ImpExp: exports RemProg line progress as JSON lines or Prometheus text (POSIX).
+#ifndef IMPEXP_H
+#define IMPEXP_H
+
+#include "remprog.h"
+
+#ifdef __cplusplus
+#include <atomic>
+#else
+#include <stdatomic.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The RemProg thread calls impexp_snapshot as often as it likes (e.g. after each
+// remp_draw_lines); at most one snapshot per period_msec is taken, independent of the frame
+// rate. An exporter thread, or the same one, calls impexp_write to format and write the
+// newest snapshot, if it hasn't been written yet. Snapshots move between the two through
+// three line buffers, handed over by atomic exchange: neither side ever waits or retries,
+// and a slow writer just skips to the newest snapshot.
+
+#define IMPEXP_LABEL_MAX 64 // bytes, including the NUL
+#define IMPEXP_BUF_MIN 1024u // text bytes one line can take, escaped, in either format
+
+typedef enum impexp_format {
+  IMPEXP_FORMAT_JSON_LINES, // {"time_ms":..,"lines":[{"id":..,"parent":..,...},..]}\n
+  IMPEXP_FORMAT_PROMETHEUS, // improg_progress_{current,max,rate}{id,parent,label} gauges
+} impexp_format_t;
+
+// A line's label is its first retained STRING value, or failing that its first label
+// widget, with trailing spaces + colons trimmed.
+typedef struct impexp_line {
+  int64_t prog_cur, prog_max; // subtree totals, as drawn
+  int64_t rate; // prog_cur units per second since the previous snapshot, 0 at first
+  uint16_t id;
+  uint16_t parent; // REMP_NO_LINE for roots
+  char label[IMPEXP_LABEL_MAX];
+} impexp_line_t;
+
+// Per line id: the line as of the last snapshot it was in, for rates.
+typedef struct impexp_track {
+  uint32_t add_seq; // the line's remp_ctx_t add_seq; a different one means the id was reused
+  int64_t prog_cur;
+  uint32_t snap_seq; // snapshot it was last seen in
+} impexp_track_t;
+
+typedef struct impexp_snap {
+  impexp_line_t *lines;
+  uint64_t mono_nsec; // CLOCK_MONOTONIC, for rates + cadence
+  uint64_t unix_msec; // CLOCK_REALTIME, as exported
+  uint16_t line_count;
+} impexp_snap_t;
+
+typedef struct impexp {
+  impexp_snap_t snaps[3];
+  impexp_track_t *tracks;
+  // Shared: the hand-over buffer's index, plus a flag while it's unwritten.
+#ifdef __cplusplus
+  std::atomic<uint32_t> mid;
+#else
+  _Atomic uint32_t mid;
+#endif
+  uint8_t back; // snapshot side's buffer
+  uint8_t front; // write side's buffer
+  uint16_t max_lines;
+  uint32_t period_msec;
+  uint32_t snap_seq; // snapshots taken
+  uint64_t last_snap_nsec;
+  impexp_format_t format;
+
+  char *buf; // caller-owned text staging, at least IMPEXP_BUF_MIN bytes
+  uint32_t buf_cap;
+  uint32_t buf_len;
+  char const *path; // Prometheus file target: written to "<path>.tmp", then renamed over
+  int fd; // -1 if closed, or for a Prometheus file
+  bool is_socket;
+  bool write_failed; // during the last impexp_write
+} impexp_t;
+
+// lines holds 3 * max_lines entries and tracks max_lines, matching the RemProg context's
+// max_lines.
+imp_ret_t impexp_init(impexp_t *exp,
+                      impexp_format_t format,
+                      unsigned period_msec,
+                      impexp_line_t *lines,
+                      impexp_track_t *tracks,
+                      uint16_t max_lines,
+                      char *buf,
+                      uint32_t buf_cap);
+
+// Targets. A JSON lines file is appended to; a Prometheus file is replaced atomically on
+// each write (e.g. for a node_exporter textfile collector), and path must outlive exp. A
+// socket target is a connected SOCK_STREAM UNIX socket; reconnect after a failed write.
+imp_ret_t impexp_open_file(impexp_t *exp, char const *path);
+imp_ret_t impexp_connect_unix(impexp_t *exp, char const *path);
+void impexp_close(impexp_t *exp);
+
+// Snapshot side. *out_taken (may be NULL) is false if the period hadn't elapsed yet.
+imp_ret_t impexp_snapshot(impexp_t *exp, remp_ctx_t const *ctx, bool *out_taken);
+
+// Write side: *out_written (may be NULL) is false if there was no new snapshot.
+imp_ret_t impexp_write(impexp_t *exp, bool *out_written);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
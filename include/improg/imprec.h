@@ -0,0 +1,59 @@
+// ImpRec: records the bytes ImProg emits, frame by frame, and replays them into any sink.
+#ifndef IMPREC_H
+#define IMPREC_H
+
+#include "improg.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// File format, little-endian, append-only and usable in place from a memory mapping:
+//   header: "IMPREC01" (8 bytes)
+//   record: uint32 len, uint32 flags, len payload bytes, NUL, zero padding to 4 bytes
+// A frame is one or more records, the last carrying IMPREC_FLAG_END_OF_FRAME (emitted on
+// the flush that ends imp_end). The NUL lets replay hand payloads to sinks without copying.
+
+#define IMPREC_MAGIC "IMPREC01"
+#define IMPREC_FLAG_END_OF_FRAME 1u
+
+typedef struct imprec {
+  FILE *f;
+  imp_print_cb_t next_cb; // NULL ok, otherwise everything is also forwarded here
+  void *next_cb_ctx;
+  char *buf; // caller-owned; fragments are batched here until a frame ends or it fills
+  uint32_t buf_cap;
+  uint32_t buf_len;
+  uint32_t frame_count;
+  bool write_failed;
+} imprec_t;
+
+// Writes the header. Pass imprec_print_cb + rec to imp_init.
+imp_ret_t imprec_init(imprec_t *rec,
+                      FILE *f,
+                      char *buf,
+                      uint32_t buf_cap,
+                      imp_print_cb_t next_cb,
+                      void *next_cb_ctx);
+void imprec_print_cb(void *rec, char const *s);
+
+typedef struct imprec_stats {
+  uint64_t byte_count;
+  uint32_t frame_count;
+} imprec_stats_t;
+
+// Feeds a whole recording (e.g. a mapped file) into print_cb. out_stats may be NULL.
+imp_ret_t imprec_replay(void const *data,
+                        size_t len,
+                        imp_print_cb_t print_cb,
+                        void *print_cb_ctx,
+                        imprec_stats_t *out_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+// ImpRing: a ring-buffer write sink for slow links like UART consoles. Output is copied into
+// a caller-owned buffer and handed to the transport (e.g. a DMA channel) in contiguous
+// chunks, so drawing never waits for bytes to drain. Frames are queued whole: a frame that
+// doesn't fit is dropped entirely, leaving the terminal as the previous frame left it.
+#ifndef IMPRING_H
+#define IMPRING_H
+
+#include "improg.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts sending data[0..len); call impring_complete once it has all been sent. Only one
+// chunk is in flight at a time, and it stays valid + untouched until completed.
+typedef void (*impring_start_cb_t)(void *ctx, char const *data, size_t len);
+
+typedef struct impring {
+  char *buf; // caller-owned, capacity bytes
+  uint32_t mask; // capacity - 1
+  uint32_t head, tail; // free-running write + read positions; head - tail bytes are queued
+  uint32_t committed; // end of the last whole frame; only committed - tail bytes are sent
+  uint32_t in_flight; // bytes handed to start_cb and not yet completed, 0 when idle
+  impring_start_cb_t start_cb;
+  void *start_cb_ctx;
+  uint64_t bytes_written;
+  uint64_t bytes_dropped;
+  uint64_t frames_dropped; // pass to remp_set_drop_counter, or imp_resync after each change
+  bool overflowed; // part of the frame being written didn't fit; it's dropped at the flush
+} impring_t;
+
+// capacity must be a power of two.
+imp_ret_t impring_init(impring_t *ring,
+                       char *buf,
+                       uint32_t capacity,
+                       impring_start_cb_t start_cb,
+                       void *start_cb_ctx);
+
+// Pass impring_write_cb + ring to imp_init_write. Writes are staged until the flush that ends
+// each frame, which commits them and starts a transfer if the link is idle; if any of the
+// frame didn't fit, the flush drops all of it instead.
+void impring_write_cb(void *ring, char const *data, size_t len);
+
+// Retires the in-flight chunk and starts the next one, if anything is queued. Not safe to
+// call concurrently with impring_write_cb: from an interrupt, defer it to the drawing
+// context (e.g. set a flag the main loop polls) or mask interrupts around drawing.
+void impring_complete(impring_t *ring);
+
+// Bytes that can be queued without dropping; a frame budget for remp_set_frame_budget.
+uint32_t impring_free(impring_t const *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
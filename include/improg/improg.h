@@ -3,8 +3,32 @@
 #define IMPROG_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Define IMP_FIXED_POINT for targets without an FPU: progress ratios, bar layout and percent
+// + size formatting then use 64-bit integer math, and int64_t counts keep 31 significant bits
+// instead of float's 24. IMP_NO_DOUBLE implies it and also compiles out double values
+// (IMP_VALUE_TYPE_DOUBLE is then rejected), leaving no floating-point code in the library.
+#if defined(IMP_NO_DOUBLE) && !defined(IMP_FIXED_POINT)
+#define IMP_FIXED_POINT
+#endif
+
+// Progress in [0, 1]: a float, or a Q32.32 fixed-point integer with IMP_FIXED_POINT.
+#ifdef IMP_FIXED_POINT
+typedef int64_t imp_fraction_t;
+#define IMP_FRACTION_ONE ((imp_fraction_t)1 << 32)
+#define IMP_FRACTION(F) ((imp_fraction_t)((F) * IMP_FRACTION_ONE))
+#else
+typedef float imp_fraction_t;
+#define IMP_FRACTION_ONE 1.f
+#define IMP_FRACTION(F) ((float)(F))
+#endif
+
 typedef enum imp_ret {
   IMP_RET_SUCCESS = 0,
   // -1 reserved for "unused" in some fields
@@ -12,23 +36,170 @@ typedef enum imp_ret {
   IMP_RET_ERR_WRONG_VALUE_TYPE = -3,
   IMP_RET_ERR_AMBIGUOUS_WIDTH = -4,
   IMP_RET_ERR_EXHAUSTED = -5,
+  IMP_RET_ERR_SYSTEM = -6, // OS call failed, see errno
+  IMP_RET_ERR_TOO_DEEP = -7, // widget nesting exceeds IMP_MAX_WIDGET_DEPTH
 } imp_ret_t;
 
+// Widgets are measured, drawn and prepared by loops over fixed-size stacks of this many
+// frames, never by recursion, so stack use doesn't depend on the widgets. A leaf widget has
+// depth 1; composites, progress bars (edge_fill) and ping-pong bars (bouncer) add 1 to their
+// deepest sub-widget. Deeper trees are rejected with IMP_RET_ERR_TOO_DEEP before any output.
+// Each level costs one draw and one width frame, at most 6 * sizeof(void *) +
+// 2 * sizeof(imp_fraction_t) + 24 bytes (80 on LP64, 88 with IMP_FIXED_POINT; asserted in
+// improg.c). With gcc -O2 on x86-64 at the default of 8, imp_draw_line peaks at ~1.4 KB,
+// excluding snprintf and the print callback; packed programs add two imp_widget_def_t.
+// imp_draw_lines adds its batch buffers on top, see IMP_DRAW_BATCH.
+#ifndef IMP_MAX_WIDGET_DEPTH
+#define IMP_MAX_WIDGET_DEPTH 8
+#endif
+
+// imp_draw_lines computes progress fractions this many lines at a time, in stack buffers of
+// 20 bytes per line (8 with IMP_FIXED_POINT). Larger batches vectorize the divides better.
+#ifndef IMP_DRAW_BATCH
+#define IMP_DRAW_BATCH 16
+#endif
+
 typedef struct imp_value imp_value_t;
 typedef struct imp_widget_def imp_widget_def_t;
 typedef struct imp_ctx imp_ctx_t;
+typedef struct imp_history imp_history_t;
 
 typedef void (*imp_print_cb_t)(void *ctx, char const *s);
 
+// Length-aware sink: data is not NUL-terminated, and (NULL, 0) is a flush. Slices of caller
+// strings are passed through without copying, and lengths come from the formatter.
+typedef void (*imp_write_cb_t)(void *ctx, char const *data, size_t len);
+
 imp_ret_t imp_init(imp_ctx_t *ctx, imp_print_cb_t print_cb, void *print_cb_ctx);
+imp_ret_t imp_init_write(imp_ctx_t *ctx, imp_write_cb_t write_cb, void *write_cb_ctx);
 imp_ret_t imp_begin(imp_ctx_t *ctx, uint16_t terminal_width);
 imp_ret_t imp_draw_line(imp_ctx_t *ctx,
                         imp_value_t const *progress_cur,
                         imp_value_t const *progress_max,
                         imp_widget_def_t const *widget,
                         imp_value_t const *value);
+
+// As imp_draw_line, but value's shape, and widget's depth, have already been checked by the
+// caller (e.g. improg.hpp, at compile time), so per-widget value type checks and the up-front
+// depth walk are skipped.
+imp_ret_t imp_draw_line_unchecked(imp_ctx_t *ctx,
+                                  imp_value_t const *progress_cur,
+                                  imp_value_t const *progress_max,
+                                  imp_widget_def_t const *widget,
+                                  imp_value_t const *value);
+
+// Draws line_count lines in one call. Arrays are parallel and indexed by line; prog_curs and
+// prog_maxs may both be NULL for a frame without progress, and a line whose prog_curs entry
+// is IMP_VALUE_NULL() has no progress. Every line's progress is checked before anything is drawn,
+// so invalid progress fails the call without a partial frame.
+imp_ret_t imp_draw_lines(imp_ctx_t *ctx,
+                         int line_count,
+                         imp_value_t const *prog_curs,
+                         imp_value_t const *prog_maxs,
+                         imp_widget_def_t const *const *widgets,
+                         imp_value_t const *const *values);
+
+// Parallel formatting for very large frames: imp_draw_lines_parallel splits the lines into
+// task_count contiguous runs, and formats each run into its own slice of work through exec,
+// which runs task(task_ctx, i) for every i in [0, task_count), in any order and possibly
+// concurrently, and returns once all have finished; NULL runs them in turn. The formatted
+// lines are then emitted in order, so a frame that draws cleanly matches imp_draw_lines byte
+// for byte. Lines that don't fit their slice, or fail, are redrawn serially. ctx (including
+// its width cache) is only read while tasks run, and print/write callbacks are only called
+// after.
+typedef void (*imp_task_cb_t)(void *task_ctx, int task_idx);
+typedef void (*imp_exec_cb_t)(void *exec_ctx,
+                              int task_count,
+                              imp_task_cb_t task,
+                              void *task_ctx);
+
+// work holds IMP_PAR_LINE_OVERHEAD bytes per line; the rest is split evenly between tasks.
+#define IMP_PAR_LINE_OVERHEAD 12u
+
+typedef struct imp_par {
+  imp_exec_cb_t exec; // NULL ok
+  void *exec_ctx;
+  void *work; // caller-owned, 8-byte aligned
+  size_t work_size;
+  int task_count;
+} imp_par_t;
+
+imp_ret_t imp_draw_lines_parallel(imp_ctx_t *ctx,
+                                  imp_par_t const *par,
+                                  int line_count,
+                                  imp_value_t const *prog_curs,
+                                  imp_value_t const *prog_maxs,
+                                  imp_widget_def_t const *const *widgets,
+                                  imp_value_t const *const *values);
+
+// Leaves the next line as it was drawn last frame, emitting nothing for it; the cursor only
+// moves over skipped lines when a later line needs drawing. Lines past the end of the last
+// frame can't be skipped.
+imp_ret_t imp_skip_line(imp_ctx_t *ctx);
+
+// Leaves the lines drawn so far this frame behind as scrollback, as a finished frame would;
+// the rest of the frame is drawn below them, and later frames never touch them again.
+imp_ret_t imp_retire_lines(imp_ctx_t *ctx);
+
 imp_ret_t imp_end(imp_ctx_t *ctx, bool done);
 
+// For write sinks that drop whole frames (e.g. ImpRing): call between frames once the last
+// one was dropped. The cursor + frame state are put back as that frame's imp_begin found
+// them, before any imp_retire_lines, and no line of the next frame may be skipped, as the
+// screen doesn't hold the dropped frame's lines. Lines the dropped frame retired aren't in
+// the scrollback either: draw + retire them again at the top of the next frame.
+imp_ret_t imp_resync(imp_ctx_t *ctx);
+
+// Constant-width cache: imp_widget_prepare walks a widget tree once and records the display
+// width of every constant string it references (labels, bar ends + fills, custom trims,
+// spinner frames, progress label entries) in a caller-owned open-addressed table keyed by
+// string address. Drawing then looks widths up instead of re-decoding the UTF-8 each frame.
+// Prepared strings must outlive the cache. capacity must be a power of two.
+
+typedef struct imp_width_entry {
+  char const *s; // NULL for empty slot
+  int16_t dw; // display width of s
+  uint32_t len; // byte length of s
+} imp_width_entry_t;
+
+// Optional terminal capabilities; none are assumed by default.
+typedef enum imp_term_cap {
+  IMP_TERM_CAP_REP = 1 << 0, // ECMA-48 REP (CSI n b), repeat preceding graphic character
+} imp_term_cap_t;
+
+imp_ret_t imp_set_term_caps(imp_ctx_t *ctx, unsigned caps); // bitwise-or of imp_term_cap_t
+
+imp_ret_t imp_set_width_cache(imp_ctx_t *ctx, imp_width_entry_t *entries, uint16_t capacity);
+imp_ret_t imp_widget_prepare(imp_ctx_t *ctx, imp_widget_def_t const *widget);
+
+// Nesting depth of widget, for checking trees against IMP_MAX_WIDGET_DEPTH ahead of time.
+imp_ret_t imp_widget_depth(imp_widget_def_t const *widget, int *out_depth);
+
+// Packed widgets: imp_pack_widget compiles a widget tree into a byte program that
+// imp_draw_line_packed runs in place, e.g. straight from flash, with no imp_widget_def_t in
+// memory. Nodes are 3-14 bytes and refer to strings and sub-widgets by 16-bit offsets into
+// the program, and identical strings are stored once, so programs are limited to 64 KB. The
+// encoding is byte-oriented and endian-neutral: pack on the host and embed the bytes as a
+// const array aligned to IMP_PACK_ALIGN. Several widgets can share one program; each call
+// appends at *io_len and returns the widget's node offset. prog's tail past the result is
+// used as scratch. Programs are trusted, so only run ones imp_pack_widget produced.
+#define IMP_PACK_ALIGN 8
+
+imp_ret_t imp_pack_widget(imp_widget_def_t const *widget,
+                          uint8_t *prog,
+                          uint32_t prog_cap,
+                          uint32_t *io_len,
+                          uint16_t *out_node);
+
+imp_ret_t imp_draw_line_packed(imp_ctx_t *ctx,
+                               imp_value_t const *progress_cur,
+                               imp_value_t const *progress_max,
+                               uint8_t const *prog,
+                               uint16_t node,
+                               imp_value_t const *value);
+
+imp_ret_t imp_widget_prepare_packed(imp_ctx_t *ctx, uint8_t const *prog, uint16_t node);
+
 // Widgets
 
 typedef enum imp_widget_type {
@@ -43,6 +214,8 @@ typedef enum imp_widget_type {
   IMP_WIDGET_TYPE_SPINNER,            // animated label flipbook
   IMP_WIDGET_TYPE_STRING,             // dynamic string
   IMP_WIDGET_TYPE_COMPOSITE,          // list of sub-widgets
+  IMP_WIDGET_TYPE_STACKED_BAR,        // dynamic-width bar split into segments by counts
+  IMP_WIDGET_TYPE_SPARKLINE,          // recent sample history as block-element columns
 } imp_widget_type_t;
 
 typedef enum imp_unit {
@@ -133,12 +306,12 @@ typedef struct imp_widget_progress_scalar {
     .precision = (PRECISION), .field_width = (FIELD_WIDTH), .unit = (UNIT) } } }
 
 typedef struct imp_widget_progress_label_entry {
-  float threshold; // upper bound, non-inclusive
+  imp_fraction_t threshold; // upper bound, non-inclusive
   char const *s;
 } imp_widget_progress_label_entry_t;
 
 #define IMP_WIDGET_PROGRESS_LABEL_ENTRY(THRESHOLD, STRING) \
-  { .threshold = (THRESHOLD), .s = STRING }
+  { .threshold = IMP_FRACTION(THRESHOLD), .s = STRING }
 
 typedef struct imp_widget_progress_label {
   imp_widget_progress_label_entry_t const *labels;
@@ -181,6 +354,45 @@ typedef struct imp_widget_ping_pong_bar {
   char const *fill; // single-column grapheme to paint the background with
 } imp_widget_ping_pong_bar_t;
 
+// A stacked bar's value is a composite of segment_count scalar counts (e.g. done, failed,
+// in flight). Segments are filled left to right in proportion to the line's progress max,
+// or to the counts' sum for a line without progress or with a max of 0; empty_fill paints
+// the rest.
+typedef struct imp_widget_stacked_bar_segment {
+  char const *color; // NULL ok, emitted before the segment's fill (e.g. IMP_COLOR_FG_RED)
+  char const *fill; // single-column grapheme
+} imp_widget_stacked_bar_segment_t;
+
+#define IMP_WIDGET_STACKED_BAR_SEGMENT(COLOR, FILL) { .color = COLOR, .fill = FILL }
+
+typedef struct imp_widget_stacked_bar {
+  char const *left_end;
+  char const *right_end;
+  char const *empty_fill;
+  imp_widget_stacked_bar_segment_t const *segments;
+  int16_t segment_count;
+  int16_t field_width; // -1 for space-filling
+} imp_widget_stacked_bar_t;
+
+#define IMP_WIDGET_STACKED_BAR( \
+  FIELD_WIDTH, LEFT_END, RIGHT_END, EMPTY_FILL, SEGMENT_COUNT, SEGMENT_ARRAY) \
+  { .type = IMP_WIDGET_TYPE_STACKED_BAR, .w = { .stacked_bar = { \
+    .field_width = (FIELD_WIDTH), .left_end = LEFT_END, .right_end = RIGHT_END, \
+    .empty_fill = EMPTY_FILL, .segment_count = (SEGMENT_COUNT), \
+    .segments = (imp_widget_stacked_bar_segment_t const[]) SEGMENT_ARRAY } } }
+
+// A sparkline's value is an imp_history_t: its newest samples, one per column and oldest
+// first, are drawn as U+2581-2588 blocks scaled between the ring's minimum and maximum.
+// Columns without a sample yet are blank. A flat history is drawn at full height, or at the
+// bottom if it's zero or less, so a stall reads as a run of low blocks either way.
+typedef struct imp_widget_sparkline {
+  int16_t field_width; // -1 for one column per ring slot
+} imp_widget_sparkline_t;
+
+#define IMP_WIDGET_SPARKLINE(FIELD_WIDTH) \
+  { .type = IMP_WIDGET_TYPE_SPARKLINE, .w = { .sparkline = { \
+    .field_width = (int16_t)(FIELD_WIDTH) } } }
+
 typedef struct imp_widget_composite {
   struct imp_widget_def const *widgets;
   int16_t widget_count;
@@ -204,6 +416,8 @@ struct imp_widget_def {
     imp_widget_progress_scalar_t progress_scalar;
     imp_widget_ping_pong_bar_t ping_pong_bar;
     imp_widget_composite_t composite;
+    imp_widget_stacked_bar_t stacked_bar;
+    imp_widget_sparkline_t sparkline;
   } w;
   imp_widget_type_t type;
 };
@@ -213,9 +427,11 @@ struct imp_widget_def {
 typedef enum {
   IMP_VALUE_TYPE_NULL,
   IMP_VALUE_TYPE_INT,
-  IMP_VALUE_TYPE_DOUBLE,
+  IMP_VALUE_TYPE_DOUBLE, // unused with IMP_NO_DOUBLE
   IMP_VALUE_TYPE_STRING,
   IMP_VALUE_TYPE_COMPOSITE,
+  IMP_VALUE_TYPE_STRING_SPAN, // v.sp: byte-length-delimited, needn't be NUL-terminated
+  IMP_VALUE_TYPE_HISTORY, // v.h: sample ring for sparklines
 } imp_value_type_t;
 
 typedef struct imp_value_composite {
@@ -223,30 +439,86 @@ typedef struct imp_value_composite {
   int16_t value_count;
 } imp_value_composite_t;
 
+typedef struct imp_value_span {
+  char const *data; // UTF-8 without embedded NULs
+  size_t len; // bytes
+} imp_value_span_t;
+
 struct imp_value {
   union {
     int64_t i;
+#ifndef IMP_NO_DOUBLE
     double d;
+#endif
     char const *s;
     imp_value_composite_t c;
+    imp_value_span_t sp;
+    imp_history_t const *h;
   } v;
   imp_value_type_t type;
 };
 
 #define IMP_VALUE_NULL() { .type = IMP_VALUE_TYPE_NULL }
 #define IMP_VALUE_INT(I) { .type = IMP_VALUE_TYPE_INT, .v = { .i = (int64_t)(I) } }
+#ifndef IMP_NO_DOUBLE
 #define IMP_VALUE_DOUBLE(D) { .type = IMP_VALUE_TYPE_DOUBLE, .v = { .d = (double)(D) } }
+#endif
 #define IMP_VALUE_STRING(S) { .type = IMP_VALUE_TYPE_STRING, .v = { .s = (S) } }
+#define IMP_VALUE_STRING_SPAN(DATA, LEN) { .type = IMP_VALUE_TYPE_STRING_SPAN, .v = { \
+  .sp = { .data = (DATA), .len = (size_t)(LEN) } } }
 #define IMP_VALUE_COMPOSITE(COUNT, VALUES) { .type = IMP_VALUE_TYPE_COMPOSITE, .v = { \
   .c = { .value_count = (COUNT), .values = (imp_value_t const[])VALUES } } }
+#define IMP_VALUE_HISTORY(H) { .type = IMP_VALUE_TYPE_HISTORY, .v = { .h = (H) } }
+
+// Sample history: a caller-owned ring of the last capacity samples, e.g. a transfer rate
+// pushed once per frame. Each slot also holds one entry of two monotonic queues, which keep
+// the window's minimum and maximum current as samples arrive and expire, so pushes are O(1)
+// amortized and sparklines draw in one pass without rescanning for their scale. capacity
+// must be a power of two.
+typedef struct imp_history_slot {
+  int64_t sample;
+  uint32_t min_seq, max_seq; // queue entries: sequence numbers of candidate minima + maxima
+} imp_history_slot_t;
+
+struct imp_history {
+  imp_history_slot_t *slots;
+  uint32_t mask; // capacity - 1
+  uint32_t count; // samples ever pushed, modulo 2^32; sample n lives in slots[n & mask]
+  uint32_t len; // samples held, at most capacity
+  uint32_t min_head, min_tail; // queue of rising samples, oldest (the minimum) at head
+  uint32_t max_head, max_tail; // queue of falling samples, oldest (the maximum) at head
+};
+
+imp_ret_t imp_history_init(imp_history_t *h, imp_history_slot_t *slots, uint32_t capacity);
+void imp_history_push(imp_history_t *h, int64_t sample);
+
+// False if h is empty.
+bool imp_history_range(imp_history_t const *h, int64_t *out_min, int64_t *out_max);
 
 
 struct imp_ctx { // mutable, stateful across one set of lines
-  imp_print_cb_t print_cb;
-  void *print_cb_ctx;
+  imp_print_cb_t print_cb; // NULL when write_cb is set
+  imp_write_cb_t write_cb; // NULL when print_cb is set
+  void *print_cb_ctx; // passed to either
+  imp_width_entry_t *width_cache; // NULL ok
+  uint16_t width_cache_capacity;
+  uint16_t term_caps;
   uint16_t terminal_width;
   uint16_t last_frame_line_count;
   uint16_t cur_frame_line_count;
+  uint16_t cursor_row; // relative to the frame's first line
+  uint16_t screen_rows; // rows below the frame top that exist, and so don't need scrolling in
+  uint32_t frame_bytes; // bytes passed to write_cb since imp_begin; print_cb isn't measured
+  bool cursor_at_line_start;
+  bool no_skip; // set by imp_resync until the next imp_end
+  // Frame state as imp_begin found it, restored by imp_resync.
+  uint16_t begin_line_count, begin_cursor_row, begin_screen_rows;
+  bool begin_at_line_start;
+  uint8_t const *pack; // program being run by imp_draw_line_packed, NULL otherwise
+  imp_widget_def_t *pack_defs; // its nodes are decoded here, on that call's stack
+  bool trusted_values; // set for the duration of imp_draw_line_unchecked
+  bool trusted_depth; // set while drawing trees already checked against IMP_MAX_WIDGET_DEPTH
+  bool progress_q32; // set while a fixed-point scale-fill edge draws: progress is Q32.32 of 1
 };
 
 // Utility stuff, helpers
@@ -299,6 +571,8 @@ bool imp_util_isatty(void);
 
 // https://en.wikipedia.org/wiki/ANSI_escape_code#CSI_sequences
 #define IMP_PREVLINE "\033[%dF"
+#define IMP_NEXTLINE "\033[%dE"
+#define IMP_REPEAT "\033[%db"
 #define IMP_HIDE_CURSOR "\033[?25l"
 #define IMP_SHOW_CURSOR "\033[?25h"
 #define IMP_ERASE_CURSOR_TO_LINE_END "\033[0K"
@@ -306,4 +580,8 @@ bool imp_util_isatty(void);
 #define IMP_AUTO_WRAP_DISABLE "\033[?7l"
 #define IMP_AUTO_WRAP_ENABLE "\033[?7h"
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,460 @@
+// ImProg C++20 wrapper: constexpr widget trees, compile-time value checking, thin context.
+#ifndef IMPROG_HPP
+#define IMPROG_HPP
+
+#include "improg.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+// Widgets are types. Each exposes a static constexpr imp_widget_def_t `def` that lives in
+// read-only data, and describes which values it consumes so imp::ctx::draw_line can check
+// the caller's arguments at compile time and call imp_draw_line_unchecked:
+//
+//   using row = imp::composite<-1,
+//     imp::label<"copying ">,
+//     imp::string<-1, 24>,
+//     imp::label<" ">,
+//     imp::progress_bar<-1, "[", "]", "=", " ", imp::label<">">>,
+//     imp::progress_percent<7, 2>>;
+//
+//   c.draw_line<row>(imp::progress(cur, max), "some/file/path.txt");
+//
+// Arguments are the values of the value-consuming leaves (scalars, spinners, strings,
+// sparklines), in depth-first order. Labels and progress-driven widgets consume nothing.
+
+namespace imp {
+
+template <std::size_t N>
+struct fixed_string {
+  char data[N];
+  constexpr fixed_string(char const (&s)[N]) noexcept {  // NOLINT: implicit by design
+    for (std::size_t i = 0; i < N; ++i) { data[i] = s[i]; }
+  }
+};
+
+enum class slot { scalar, string, history };
+
+namespace detail {
+
+template <std::size_t... Ns>
+constexpr auto concat(std::array<slot, Ns> const &...as) noexcept {
+  std::array<slot, (Ns + ... + 0)> out{};
+  std::size_t i = 0;
+  ((void)[&] { for (slot s : as) { out[i++] = s; } }(), ...);
+  return out;
+}
+
+template <std::size_t N>
+constexpr std::array<std::size_t, N + 1> prefix_sums(std::array<std::size_t, N> xs) noexcept {
+  std::array<std::size_t, N + 1> out{};
+  for (std::size_t i = 0; i < N; ++i) { out[i + 1] = out[i] + xs[i]; }
+  return out;
+}
+
+template <class T>
+constexpr bool is_string_v = std::is_convertible_v<T, char const *>;
+
+// std::string, std::string_view etc. pass as zero-copy STRING_SPAN values.
+template <class T>
+constexpr bool is_string_view_v =
+  !is_string_v<T> && std::is_convertible_v<T const &, std::string_view>;
+
+template <class T>
+constexpr bool is_history_v = std::is_convertible_v<T, imp_history_t const *>;
+
+template <class T>
+constexpr bool fits(slot s) noexcept {
+  using U = std::remove_cvref_t<T>;
+  if (s == slot::scalar) { return std::is_arithmetic_v<U> && !std::is_same_v<U, bool>; }
+  if (s == slot::string) {  // a literal nullptr is no string, though it converts to one
+    return !std::is_null_pointer_v<U> && (is_string_v<U> || is_string_view_v<U>);
+  }
+  return is_history_v<U>;
+}
+
+template <class T>
+imp_value_t to_value(T const &x) noexcept {
+  if constexpr (is_string_v<T>) {
+    imp_value_t v{}; v.type = IMP_VALUE_TYPE_STRING; v.v.s = x; return v;
+  } else if constexpr (is_history_v<T>) {
+    imp_value_t v{}; v.type = IMP_VALUE_TYPE_HISTORY; v.v.h = x; return v;
+  } else if constexpr (is_string_view_v<T>) {
+    std::string_view const sv = x;
+    imp_value_t v{}; v.type = IMP_VALUE_TYPE_STRING_SPAN; v.v.sp = { sv.data(), sv.size() };
+    return v;
+  } else if constexpr (std::is_floating_point_v<T>) {
+#ifdef IMP_NO_DOUBLE
+    static_assert(!std::is_floating_point_v<T>, "double values are compiled out");
+    return imp_value_t{};
+#else
+    imp_value_t v{}; v.type = IMP_VALUE_TYPE_DOUBLE; v.v.d = static_cast<double>(x); return v;
+#endif
+  } else {
+    imp_value_t v{}; v.type = IMP_VALUE_TYPE_INT; v.v.i = static_cast<int64_t>(x); return v;
+  }
+}
+
+constexpr imp_widget_def_t make_def(imp_widget_type_t type, auto init) noexcept {
+  imp_widget_def_t d{};
+  init(d.w);
+  d.type = type;
+  return d;
+}
+
+// Nesting depth as imp_widget_depth counts it, so draw_line can check it at compile time.
+constexpr int widget_depth(imp_widget_def_t const &w) noexcept {
+  int sub = 0;
+  if (w.type == IMP_WIDGET_TYPE_COMPOSITE) {
+    for (int i = 0; i < w.w.composite.widget_count; ++i) {
+      int const d = widget_depth(w.w.composite.widgets[i]);
+      sub = (d > sub) ? d : sub;
+    }
+  } else if ((w.type == IMP_WIDGET_TYPE_PROGRESS_BAR) && w.w.progress_bar.edge_fill) {
+    sub = widget_depth(*w.w.progress_bar.edge_fill);
+  } else if ((w.type == IMP_WIDGET_TYPE_PING_PONG_BAR) && w.w.ping_pong_bar.bouncer) {
+    sub = widget_depth(*w.w.ping_pong_bar.bouncer);
+  }
+  return 1 + sub;
+}
+
+// Leaves fill their own imp_value_t from the flat argument array; no child storage.
+struct leaf {
+  static constexpr std::size_t extra = 0;
+};
+
+struct no_value : leaf {
+  static constexpr std::array<slot, 0> slots{};
+  static void fill(imp_value_t &self, imp_value_t *, imp_value_t const *) noexcept {
+    self = imp_value_t{}; self.type = IMP_VALUE_TYPE_NULL;
+  }
+};
+
+template <slot S>
+struct one_value : leaf {
+  static constexpr std::array<slot, 1> slots{ S };
+  static void fill(imp_value_t &self, imp_value_t *, imp_value_t const *args) noexcept {
+    self = args[0];
+  }
+};
+
+}  // namespace detail
+
+template <fixed_string S>
+struct label : detail::no_value {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_LABEL,
+    [](auto &w) { w.label.s = S.data; });
+};
+
+template <int16_t FieldWidth, int16_t MaxLen>
+struct string : detail::one_value<slot::string> {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_STRING,
+    [](auto &w) {
+      w.str.custom_trim = nullptr;
+      w.str.field_width = FieldWidth;
+      w.str.max_len = MaxLen;
+      w.str.trim_left = false;
+    });
+};
+
+template <int16_t FieldWidth, int16_t MaxLen, fixed_string Trim, bool TrimLeft>
+struct string_custom_trim : detail::one_value<slot::string> {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_STRING,
+    [](auto &w) {
+      w.str.custom_trim = Trim.data;
+      w.str.field_width = FieldWidth;
+      w.str.max_len = MaxLen;
+      w.str.trim_left = TrimLeft;
+    });
+};
+
+template <int16_t FieldWidth, int16_t Precision, imp_unit_t Unit = IMP_UNIT_NONE>
+struct scalar : detail::one_value<slot::scalar> {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_SCALAR,
+    [](auto &w) {
+      w.scalar.unit = Unit;
+      w.scalar.field_width = FieldWidth;
+      w.scalar.precision = Precision;
+    });
+};
+
+template <uint16_t SpeedMsec, fixed_string... Frames>
+struct spinner : detail::one_value<slot::scalar> {
+  static_assert(sizeof...(Frames) > 0, "spinner needs at least one frame");
+  static constexpr char const *frames[] = { Frames.data... };
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_SPINNER,
+    [](auto &w) {
+      w.spinner.frames = frames;
+      w.spinner.frame_count = static_cast<uint16_t>(sizeof...(Frames));
+      w.spinner.speed_msec = SpeedMsec;
+    });
+};
+
+template <int16_t FieldWidth, int16_t Precision, imp_unit_t Unit = IMP_UNIT_NONE>
+struct progress_fraction : detail::no_value {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_PROGRESS_FRACTION,
+    [](auto &w) {
+      w.progress_fraction.unit = Unit;
+      w.progress_fraction.field_width = FieldWidth;
+      w.progress_fraction.precision = Precision;
+    });
+};
+
+template <int16_t FieldWidth, int16_t Precision>
+struct progress_percent : detail::no_value {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_PROGRESS_PERCENT,
+    [](auto &w) {
+      w.progress_percent.field_width = FieldWidth;
+      w.progress_percent.precision = Precision;
+    });
+};
+
+template <int16_t FieldWidth, int16_t Precision, imp_unit_t Unit = IMP_UNIT_NONE>
+struct progress_scalar : detail::no_value {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_PROGRESS_SCALAR,
+    [](auto &w) {
+      w.progress_scalar.unit = Unit;
+      w.progress_scalar.field_width = FieldWidth;
+      w.progress_scalar.precision = Precision;
+    });
+};
+
+// Threshold is Num / Den, an upper bound on progress (non-inclusive).
+template <int Num, int Den, fixed_string S>
+struct progress_label_entry {
+  static constexpr imp_widget_progress_label_entry_t entry{
+    static_cast<imp_fraction_t>(Num) * IMP_FRACTION_ONE / static_cast<imp_fraction_t>(Den),
+    S.data };
+};
+
+template <int16_t FieldWidth, class... Entries>
+struct progress_label : detail::no_value {
+  static_assert(sizeof...(Entries) > 0, "progress_label needs at least one entry");
+  static constexpr imp_widget_progress_label_entry_t entries[] = { Entries::entry... };
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_PROGRESS_LABEL,
+    [](auto &w) {
+      w.progress_label.labels = entries;
+      w.progress_label.label_count = static_cast<int16_t>(sizeof...(Entries));
+      w.progress_label.field_width = FieldWidth;
+    });
+};
+
+namespace detail {
+
+// Progress bars hand their value straight to edge_fill, so they consume what it consumes.
+template <bool ScaleFill, int16_t FieldWidth, fixed_string L, fixed_string R,
+          fixed_string Full, fixed_string Empty, class EdgeFill>
+struct progress_bar_base {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_PROGRESS_BAR,
+    [](auto &w) {
+      w.progress_bar.left_end = L.data;
+      w.progress_bar.right_end = R.data;
+      w.progress_bar.full_fill = Full.data;
+      w.progress_bar.empty_fill = Empty.data;
+      w.progress_bar.edge_fill = &EdgeFill::def;
+      w.progress_bar.field_width = FieldWidth;
+      w.progress_bar.scale_fill = ScaleFill;
+    });
+  static constexpr auto slots = EdgeFill::slots;
+  static constexpr std::size_t extra = EdgeFill::extra;
+  static void fill(imp_value_t &self, imp_value_t *pool, imp_value_t const *args) noexcept {
+    EdgeFill::fill(self, pool, args);
+  }
+};
+
+}  // namespace detail
+
+template <int16_t FieldWidth, fixed_string L, fixed_string R, fixed_string Full,
+          fixed_string Empty, class EdgeFill>
+struct progress_bar
+  : detail::progress_bar_base<false, FieldWidth, L, R, Full, Empty, EdgeFill> {};
+
+template <int16_t FieldWidth, fixed_string L, fixed_string R, fixed_string Full,
+          fixed_string Empty, class EdgeFill>
+struct progress_bar_scale_edge_fill
+  : detail::progress_bar_base<true, FieldWidth, L, R, Full, Empty, EdgeFill> {};
+
+// Ping-pong bars hand their value straight to the bouncer, so they consume what it consumes.
+template <int16_t FieldWidth, fixed_string L, fixed_string R, fixed_string Fill, class Bouncer>
+struct ping_pong_bar {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_PING_PONG_BAR,
+    [](auto &w) {
+      w.ping_pong_bar.field_width = FieldWidth;
+      w.ping_pong_bar.left_end = L.data;
+      w.ping_pong_bar.right_end = R.data;
+      w.ping_pong_bar.bouncer = &Bouncer::def;
+      w.ping_pong_bar.fill = Fill.data;
+    });
+  static constexpr auto slots = Bouncer::slots;
+  static constexpr std::size_t extra = Bouncer::extra;
+  static void fill(imp_value_t &self, imp_value_t *pool, imp_value_t const *args) noexcept {
+    Bouncer::fill(self, pool, args);
+  }
+};
+
+// An empty Color emits nothing.
+template <fixed_string Color, fixed_string Fill>
+struct stacked_bar_segment {
+  static constexpr imp_widget_stacked_bar_segment_t segment{
+    Color.data[0] ? Color.data : nullptr, Fill.data };
+};
+
+// Consumes an imp_history_t *.
+template <int16_t FieldWidth>
+struct sparkline : detail::one_value<slot::history> {
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_SPARKLINE,
+    [](auto &w) { w.sparkline.field_width = FieldWidth; });
+};
+
+// Consumes one scalar count per segment.
+template <int16_t FieldWidth, fixed_string L, fixed_string R, fixed_string Empty,
+          class... Segments>
+struct stacked_bar {
+  static_assert(sizeof...(Segments) > 0, "stacked_bar needs at least one segment");
+  static constexpr std::size_t count = sizeof...(Segments);
+  static constexpr imp_widget_stacked_bar_segment_t segments[] = { Segments::segment... };
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_STACKED_BAR,
+    [](auto &w) {
+      w.stacked_bar.left_end = L.data;
+      w.stacked_bar.right_end = R.data;
+      w.stacked_bar.empty_fill = Empty.data;
+      w.stacked_bar.segments = segments;
+      w.stacked_bar.segment_count = static_cast<int16_t>(count);
+      w.stacked_bar.field_width = FieldWidth;
+    });
+
+  static constexpr auto slots = [] {
+    std::array<slot, count> out{};
+    out.fill(slot::scalar);
+    return out;
+  }();
+  static constexpr std::size_t extra = count;
+
+  static void fill(imp_value_t &self, imp_value_t *pool, imp_value_t const *args) noexcept {
+    self = imp_value_t{};
+    self.type = IMP_VALUE_TYPE_COMPOSITE;
+    self.v.c.values = pool;
+    self.v.c.value_count = static_cast<int16_t>(count);
+    for (std::size_t i = 0; i < count; ++i) { pool[i] = args[i]; }
+  }
+};
+
+template <int16_t MaxLen, class... Ws>
+struct composite {
+  static_assert(sizeof...(Ws) > 0, "composite needs at least one widget");
+  static constexpr std::size_t count = sizeof...(Ws);
+  static constexpr imp_widget_def_t widgets[] = { Ws::def... };
+  static constexpr imp_widget_def_t def = detail::make_def(IMP_WIDGET_TYPE_COMPOSITE,
+    [](auto &w) {
+      w.composite.widgets = widgets;
+      w.composite.widget_count = static_cast<int16_t>(count);
+      w.composite.max_len = MaxLen;
+    });
+
+  static constexpr auto slots = detail::concat(Ws::slots...);
+
+  // Children's values occupy pool[0, count); each child's own storage follows.
+  static constexpr std::size_t extra = count + (Ws::extra + ... + 0);
+
+  static void fill(imp_value_t &self, imp_value_t *pool, imp_value_t const *args) noexcept {
+    self = imp_value_t{};
+    self.type = IMP_VALUE_TYPE_COMPOSITE;
+    self.v.c.values = pool;
+    self.v.c.value_count = static_cast<int16_t>(count);
+    fill_children(pool, args, std::make_index_sequence<count>{});
+  }
+
+ private:
+  static constexpr auto arg_offs = detail::prefix_sums(
+    std::array<std::size_t, count>{ Ws::slots.size()... });
+  static constexpr auto pool_offs = detail::prefix_sums(
+    std::array<std::size_t, count>{ Ws::extra... });
+
+  template <std::size_t... Is>
+  static void fill_children(imp_value_t *pool,
+                            imp_value_t const *args,
+                            std::index_sequence<Is...>) noexcept {
+    (Ws::fill(pool[Is], pool + count + pool_offs[Is], args + arg_offs[Is]), ...);
+  }
+};
+
+// Current + max progress; both become int or both become double, as imp_draw_line requires.
+struct progress {
+  template <class C, class M>
+    requires std::is_arithmetic_v<C> && std::is_arithmetic_v<M>
+  progress(C c, M m) noexcept
+    : cur(detail::to_value(static_cast<std::common_type_t<C, M>>(c))),
+      max(detail::to_value(static_cast<std::common_type_t<C, M>>(m))) {}
+  imp_value_t cur, max;
+};
+
+// Selects ctx's imp_init_write constructor: imp::ctx c(imp::with_write, write_cb, cb_ctx).
+struct with_write_t {
+  explicit with_write_t() = default;
+};
+inline constexpr with_write_t with_write{};
+
+class ctx {
+ public:
+  explicit ctx(imp_print_cb_t print_cb = nullptr, void *print_cb_ctx = nullptr) noexcept {
+    imp_init(&ctx_, print_cb, print_cb_ctx);
+  }
+  ctx(with_write_t, imp_write_cb_t write_cb, void *write_cb_ctx) noexcept {
+    imp_init_write(&ctx_, write_cb, write_cb_ctx);
+  }
+
+  ctx(ctx const &) = delete;
+  ctx &operator=(ctx const &) = delete;
+
+  imp_ret_t begin(uint16_t terminal_width) noexcept { return imp_begin(&ctx_, terminal_width); }
+  imp_ret_t end(bool done) noexcept { return imp_end(&ctx_, done); }
+  imp_ret_t retire_lines() noexcept { return imp_retire_lines(&ctx_); }
+  imp_ret_t resync() noexcept { return imp_resync(&ctx_); }
+
+  template <class W, class... Args>
+  imp_ret_t draw_line(Args const &...args) noexcept {
+    return draw<W>(nullptr, args...);
+  }
+
+  template <class W, class... Args>
+  imp_ret_t draw_line(progress const &p, Args const &...args) noexcept {
+    return draw<W>(&p, args...);
+  }
+
+  imp_ctx_t *get() noexcept { return &ctx_; }
+  imp_ctx_t const *get() const noexcept { return &ctx_; }
+
+ private:
+  template <class W, class... Args>
+  imp_ret_t draw(progress const *p, Args const &...args) noexcept {
+    static_assert(sizeof...(Args) == W::slots.size(),
+                  "argument count doesn't match the widget's value-consuming leaves");
+    static_assert(check<W, Args...>(std::index_sequence_for<Args...>{}),
+                  "argument type doesn't match its widget (scalar: arithmetic, string: "
+                  "char const *, history: imp_history_t const *)");
+    static_assert(detail::widget_depth(W::def) <= IMP_MAX_WIDGET_DEPTH,
+                  "widget nests deeper than IMP_MAX_WIDGET_DEPTH");
+
+    imp_value_t const flat[sizeof...(Args) + 1] = { detail::to_value(args)..., imp_value_t{} };
+    imp_value_t pool[W::extra + 1];
+    imp_value_t root;
+    W::fill(root, pool, flat);
+    return imp_draw_line_unchecked(
+      &ctx_, p ? &p->cur : nullptr, p ? &p->max : nullptr, &W::def, &root);
+  }
+
+  template <class W, class... Args, std::size_t... Is>
+  static constexpr bool check(std::index_sequence<Is...>) noexcept {
+    return (detail::fits<Args>(W::slots[Is]) && ... && true);
+  }
+
+  imp_ctx_t ctx_;
+};
+
+}  // namespace imp
+
+#endif
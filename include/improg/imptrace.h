@@ -0,0 +1,81 @@
+// ImpTrace: records line lifetimes + progress milestones, written as Chrome trace_event JSON.
+#ifndef IMPTRACE_H
+#define IMPTRACE_H
+
+#include "improg.h"
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Events go into a caller-owned array as they happen, with no allocation or I/O; once it's
+// full, further events are counted in dropped and discarded. imptrace_write then emits the
+// lot as a JSON object Perfetto and chrome://tracing open directly: each line id is a track
+// (tid), each line a slice from its begin to its end event, and each milestone an instant
+// on the line's track. Ids may be reused once their line has ended. RemProg records into a
+// trace set with remp_set_trace; anything else can call the record functions itself.
+
+#define IMPTRACE_NAME_MAX 24 // bytes, including the NUL
+#define IMPTRACE_NO_PARENT 0xFFFFu
+
+// Microseconds from any fixed origin.
+typedef uint64_t (*imptrace_clock_cb_t)(void *clock_cb_ctx);
+
+typedef enum imptrace_event_type {
+  IMPTRACE_EVENT_BEGIN, // line added
+  IMPTRACE_EVENT_END, // line removed
+  IMPTRACE_EVENT_MILESTONE, // progress reached a multiple of milestone_pct
+} imptrace_event_type_t;
+
+typedef struct imptrace_event {
+  uint64_t ts_usec; // since imptrace_init
+  int64_t cur, max; // progress, for END + MILESTONE
+  uint16_t line;
+  uint16_t parent; // for BEGIN; IMPTRACE_NO_PARENT for roots
+  uint8_t type; // imptrace_event_type_t
+  uint8_t pct; // for MILESTONE
+  char name[IMPTRACE_NAME_MAX]; // for BEGIN
+} imptrace_event_t;
+
+typedef struct imptrace {
+  imptrace_event_t *events; // caller-owned
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t dropped;
+  uint8_t milestone_pct; // 0 for no milestones
+  imptrace_clock_cb_t clock_cb; // NULL for timespec_get(TIME_UTC)
+  void *clock_cb_ctx;
+  uint64_t start_usec;
+} imptrace_t;
+
+imp_ret_t imptrace_init(imptrace_t *trace,
+                        imptrace_event_t *events,
+                        uint32_t capacity,
+                        unsigned milestone_pct,
+                        imptrace_clock_cb_t clock_cb,
+                        void *clock_cb_ctx);
+
+// name (NULL ok) is copied, cut to fit and with trailing spaces + colons trimmed.
+void imptrace_begin(imptrace_t *trace, uint16_t line, uint16_t parent, char const *name);
+void imptrace_end(imptrace_t *trace, uint16_t line, int64_t cur, int64_t max);
+
+// Records a milestone if going from old_cur/old_max to cur/max crossed one, once for the
+// highest one crossed. Progress going backwards records nothing.
+void imptrace_progress(imptrace_t *trace,
+                       uint16_t line,
+                       int64_t old_cur,
+                       int64_t old_max,
+                       int64_t cur,
+                       int64_t max);
+
+// Writes every recorded event, e.g. at shutdown. Lines still open have no end, and Perfetto
+// shows them running to the end of the trace.
+imp_ret_t imptrace_write(imptrace_t const *trace, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
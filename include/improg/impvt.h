@@ -0,0 +1,74 @@
+// ImpVT: a headless model of the terminal ImProg draws into. Feed it emitted bytes (directly
+// or as a print callback) and it maintains a cell grid, so emitters can be compared by the
+// screens they produce and by how many bytes each changed cell cost.
+#ifndef IMPVT_H
+#define IMPVT_H
+
+#include "improg.h"
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Understood: UTF-8 text, \r, \n (as CR+LF, i.e. a tty with ONLCR), \b, and the CSI
+// sequences A B C D E F G H K J m b, ?25 h/l, ?7 h/l. SGR covers bold, dim, italic,
+// underline, reverse, 8/16/256 colors. Everything else is consumed and ignored.
+
+#define IMPVT_MAX_PARAMS 8
+
+enum {
+  IMPVT_ATTR_BOLD = 1 << 0,
+  IMPVT_ATTR_DIM = 1 << 1,
+  IMPVT_ATTR_ITALIC = 1 << 2,
+  IMPVT_ATTR_UNDERLINE = 1 << 3,
+  IMPVT_ATTR_REVERSE = 1 << 4,
+};
+
+typedef struct impvt_cell {
+  uint32_t cp; // ' ' when blank, 0 for the right half of a two-column glyph
+  uint16_t fg, bg; // 0 is the default color, otherwise 256-color palette index + 1
+  uint8_t attrs; // IMPVT_ATTR_*
+  uint8_t width; // 1, or 2 for the left half of a two-column glyph
+} impvt_cell_t;
+
+typedef struct impvt {
+  impvt_cell_t *cells; // caller-owned, rows * cols, row-major
+  uint16_t rows, cols;
+  uint16_t row, col;
+  impvt_cell_t pen; // current SGR state; cp + width unused
+  uint32_t last_cp; // for REP
+  bool wrap_pending; // wrote the last column with auto-wrap on; next glyph wraps first
+  bool auto_wrap;
+  bool cursor_visible;
+
+  // parser state, carried across feeds
+  uint8_t state;
+  uint8_t utf8_len, utf8_need;
+  char utf8[5];
+  bool csi_private;
+  uint8_t param_count;
+  uint16_t params[IMPVT_MAX_PARAMS];
+
+  uint64_t bytes_fed;
+  uint64_t cells_changed; // cell writes, erases + scrolls that altered a cell's contents
+} impvt_t;
+
+imp_ret_t impvt_init(impvt_t *vt, impvt_cell_t *cells, int rows, int cols);
+void impvt_feed(impvt_t *vt, char const *data, size_t len);
+void impvt_print_cb(void *vt, char const *s); // pass impvt_print_cb + vt to imp_init
+void impvt_write_cb(void *vt, char const *data, size_t len); // or this to imp_init_write
+
+// True if both grids (same dimensions), cursor positions and modes are identical.
+bool impvt_equal(impvt_t const *a, impvt_t const *b);
+
+// Writes the row's glyphs as NUL-terminated UTF-8, trailing blanks trimmed, attributes
+// dropped. Returns the byte length, or -1 if the row doesn't fit in buf_cap.
+int impvt_row_text(impvt_t const *vt, int row, char *buf, int buf_cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
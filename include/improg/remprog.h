@@ -4,33 +4,228 @@
 
 #include "improg.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REMP_NO_LINE 0xFFFFu
+
 typedef struct remp_cfg {
   uint16_t max_lines;
   uint16_t max_values_per_line;
   uint16_t max_terminal_width;
-  uint16_t reqd_seat_size;
+  uint32_t reqd_seat_size;
 } remp_cfg_t;
 
+// Lines form a forest drawn in pre-order. Per-line hot data lives in parallel arrays on
+// remp_ctx_t, indexed by line id; this struct holds only the tree structure.
 typedef struct remp_line {
-  imp_widget_def_t const *w;
-  uint16_t value_start_idx;
+  imp_widget_def_t const *w; // NULL if the slot is free
+  uint32_t value_start_idx;
+  uint16_t parent;
+  uint16_t first_child, last_child;
+  uint16_t prev_sibling, next_sibling; // next_sibling links the free list for free slots
+  uint16_t depth; // 0 for roots
+  bool collapsed; // descendants aren't drawn, or formatted
+  bool hidden; // under a collapsed ancestor
+  bool dirty; // changed since last drawn; clean lines are skipped with imp_skip_line
+  bool low_priority; // may be left stale (and dirty) when the frame budget runs short
+  bool retiring; // printed once into scrollback by the next draw, then removed
+  bool selected; // picked for the frame being scheduled, see remp_set_line_limit
 } remp_line_t;
 
+// Value payloads without their tags; the type lives in the parallel value_types array.
+// Scalars, which hot updates rewrite, are packed densely apart from the references, which
+// are only read when a line is drawn.
+typedef union remp_scalar {
+  int64_t i;
+#ifndef IMP_NO_DOUBLE
+  double d;
+#endif
+} remp_scalar_t;
+
+typedef union remp_ref {
+  char const *s;
+  imp_value_composite_t c;
+  imp_value_span_t sp;
+  imp_history_t const *h;
+} remp_ref_t;
+
 typedef struct remp_ctx {
   remp_cfg_t cfg;
+  imp_ctx_t imp; // initialized with the default print callback, re-imp_init to redirect
   remp_line_t *lines;
-  imp_value_t *values;
+
+  // Indexed by line id. prog_* are subtree totals: a line's own progress plus that of all its
+  // descendants, retired ones included, kept current by propagating each update's delta up the
+  // ancestor chain.
+  int64_t *own_cur, *own_max;
+  int64_t *prog_cur, *prog_max;
+
+  // Indexed by value_start_idx + value index: 8-byte scalars, cold reference payloads +
+  // 1-byte imp_value_type_t tags, expanded into imp_value_t scratch only for lines being drawn.
+  remp_scalar_t *scalars;
+  remp_ref_t *refs;
+  uint8_t *value_types;
+  imp_value_t *scratch; // max_values_per_line
+
+  // Frame budget: bytes each line cost when last drawn (0 if unknown), indexed by line id.
+  uint16_t *line_bytes;
+  uint32_t frame_budget; // 0 for unlimited
+  uint32_t frames_skipped; // nothing fit the budget, so everything was left for later
+  uint32_t lines_deferred; // low-priority lines left stale to fit the budget
+  uint64_t const *drop_counter; // NULL ok, see remp_set_drop_counter
+  uint64_t drops_seen;
+
+  struct imptrace *trace; // NULL ok, see remp_set_trace
+
+  // Activity scheduling, see remp_set_line_limit. priority, act_seq, add_seq + heap_pos are
+  // indexed by line id; heap holds line ids, highest rank first, and is only kept while a
+  // limit is set. shown holds the last scheduled frame's lines in draw order.
+  int32_t *priority;
+  uint32_t *act_seq; // frame_seq when the line or a descendant last changed
+  uint32_t *add_seq; // orders siblings, and tells a reused line id apart
+  uint16_t *heap, *heap_pos;
+  uint16_t *frontier; // heap indices, scratch while picking a frame's lines
+  uint16_t *shown, *shown_next;
+  uint32_t frame_seq; // frames drawn
+  uint32_t next_add_seq;
+  uint16_t line_limit; // 0 for no limit
+  uint16_t heap_len;
+  uint16_t shown_count;
+  bool scheduled; // the last frame drew shown rather than every visible line
+
   uint16_t num_lines;
+  uint16_t first_root, last_root;
+  uint16_t free_head;
+  uint16_t lines_retiring; // lines flagged retiring, excluding their descendants
+  uint16_t last_terminal_width;
+  bool redraw_all; // set when visible lines were added, removed or moved
 } remp_ctx_t;
 
+// Seat size as a constant expression, for static seats whose size is fixed at link time:
+//   _Alignas(REMP_SEAT_ALIGN) static unsigned char s_seat[REMP_SEAT_SIZE(16, 4, 120)];
+// (alignas in C++). Sections start REMP_SEAT_ALIGN-aligned, in the order remp_init lays
+// them out. The terminal width doesn't size anything yet, but is taken to match remp_cfg.
+#define REMP_SEAT_ALIGN 8u
+#define REMP__SEAT_ALIGN_UP(X) \
+  (((size_t)(X) + (REMP_SEAT_ALIGN - 1u)) & ~(size_t)(REMP_SEAT_ALIGN - 1u))
+#define REMP_SEAT_SIZE(MAX_LINES, MAX_VALUES_PER_LINE, MAX_TERMINAL_WIDTH) \
+  (REMP__SEAT_ALIGN_UP(sizeof(remp_ctx_t)) + \
+   REMP__SEAT_ALIGN_UP((size_t)(MAX_LINES) * sizeof(remp_line_t)) + \
+   (4u * (size_t)(MAX_LINES) * sizeof(int64_t)) + \
+   ((size_t)(MAX_LINES) * (size_t)(MAX_VALUES_PER_LINE) * sizeof(remp_scalar_t)) + \
+   ((size_t)(MAX_LINES) * (size_t)(MAX_VALUES_PER_LINE) * sizeof(remp_ref_t)) + \
+   REMP__SEAT_ALIGN_UP((size_t)(MAX_LINES) * (size_t)(MAX_VALUES_PER_LINE)) + \
+   REMP__SEAT_ALIGN_UP((size_t)(MAX_LINES) * sizeof(uint16_t)) + \
+   REMP__SEAT_ALIGN_UP(3u * (size_t)(MAX_LINES) * sizeof(uint32_t)) + \
+   REMP__SEAT_ALIGN_UP(5u * (size_t)(MAX_LINES) * sizeof(uint16_t)) + \
+   ((size_t)(MAX_VALUES_PER_LINE) * sizeof(imp_value_t)) + (0u * (size_t)(MAX_TERMINAL_WIDTH)))
+
+// Fails the build if the static array SEAT is too small for the given limits.
+#ifdef __cplusplus
+#define REMP_SEAT_ASSERT(SEAT, MAX_LINES, MAX_VALUES_PER_LINE, MAX_TERMINAL_WIDTH) \
+  static_assert(sizeof(SEAT) >= \
+    REMP_SEAT_SIZE(MAX_LINES, MAX_VALUES_PER_LINE, MAX_TERMINAL_WIDTH), "RemProg seat too small")
+#else
+#define REMP_SEAT_ASSERT(SEAT, MAX_LINES, MAX_VALUES_PER_LINE, MAX_TERMINAL_WIDTH) \
+  _Static_assert(sizeof(SEAT) >= \
+    REMP_SEAT_SIZE(MAX_LINES, MAX_VALUES_PER_LINE, MAX_TERMINAL_WIDTH), "RemProg seat too small")
+#endif
+
 void remp_cfg(int max_lines,
               int max_values_per_line,
               int max_terminal_width,
               remp_cfg_t *out_cfg);
 
+// seat is reqd_seat_size (REMP_SEAT_SIZE) bytes, REMP_SEAT_ALIGN-aligned; *out_ctx is NULL
+// if it's misaligned.
 void remp_init(remp_cfg_t const *cfg, void *seat, remp_ctx_t **out_ctx);
+
+// remp_cfg + remp_init on a static array seat, checking its size at compile time.
+#define REMP_INIT_STATIC(SEAT, MAX_LINES, MAX_VALUES_PER_LINE, MAX_TERMINAL_WIDTH, OUT_CTX) \
+  do { \
+    REMP_SEAT_ASSERT(SEAT, MAX_LINES, MAX_VALUES_PER_LINE, MAX_TERMINAL_WIDTH); \
+    remp_cfg_t remp__cfg; \
+    remp_cfg((MAX_LINES), (MAX_VALUES_PER_LINE), (MAX_TERMINAL_WIDTH), &remp__cfg); \
+    remp_init(&remp__cfg, (SEAT), (OUT_CTX)); \
+  } while (0)
+
+// out_line_id is -1 when there's no room, def needs more than max_values_per_line values, or
+// def nests deeper than IMP_MAX_WIDGET_DEPTH.
 void remp_add_line(remp_ctx_t *ctx, imp_widget_def_t const *def, int *out_line_id);
+void remp_add_child_line(remp_ctx_t *ctx,
+                         int parent_line_id,
+                         imp_widget_def_t const *def,
+                         int *out_line_id);
+
+// Removes the line and all of its descendants.
 void remp_remove_line(remp_ctx_t *ctx, int line_id);
+
+// As remp_remove_line, but deferred to the next remp_draw_lines, which first prints the line
+// and its visible descendants once, as they stand, above the lines still drawn; they then
+// scroll away with the terminal's history and cost nothing in later frames. The subtree's
+// progress stays in its ancestors' totals. Lines hidden by a collapsed ancestor are removed
+// without being printed. With a drop counter set (remp_set_drop_counter), the lines are only
+// freed once the frame printing them wasn't dropped, and are printed again otherwise.
+void remp_retire_line(remp_ctx_t *ctx, int line_id);
+
+// value_idx indexes the composite's sub-widgets or the stacked bar's segments, or is 0 for
+// any other widget. Strings, spans, histories and composite values are held by reference, so
+// what they point at must outlive their line, and changes to it only show once the value is
+// set again (e.g. after imp_history_push) to mark the line dirty.
+void remp_set_value(remp_ctx_t *ctx, int line_id, int value_idx, imp_value_t const *value);
+void remp_set_int_values(remp_ctx_t *ctx,
+                         int value_idx,
+                         int count,
+                         int const *line_ids,
+                         int64_t const *values);
+
+// Sets the line's own progress; ancestors' totals are updated in O(depth). A line whose total
+// max is 0 is drawn without progress, as imp_draw_line does with NULL progress.
+void remp_set_progress(remp_ctx_t *ctx, int line_id, int64_t cur, int64_t max);
+void remp_set_progress_n(remp_ctx_t *ctx,
+                         int count,
+                         int const *line_ids,
+                         int64_t const *curs,
+                         int64_t const *maxs);
+void remp_add_progress(remp_ctx_t *ctx, int line_id, int64_t cur_delta);
+
+void remp_set_collapsed(remp_ctx_t *ctx, int line_id, bool collapsed);
+void remp_set_low_priority(remp_ctx_t *ctx, int line_id, bool low_priority);
+
+// Caps the bytes the next frames may emit, e.g. at impring_free() each frame; 0 lifts the
+// cap. Line costs are estimated from their last draw, so ctx->imp needs a write callback.
+// Dirty low-priority lines that don't fit are left stale until a frame with room, and a
+// frame whose other changed lines don't fit is skipped entirely. Final frames always draw
+// everything, so let the link drain before drawing one.
+void remp_set_frame_budget(remp_ctx_t *ctx, uint32_t bytes);
+
+// Watches a count of frames the write sink dropped whole, e.g. &ring->frames_dropped (NULL
+// to stop). It's checked after each frame's flush: when it has changed, imp_resync is called
+// and the next frame redraws every line, so the screen catches up with the dropped frame.
+void remp_set_drop_counter(remp_ctx_t *ctx, uint64_t const *frames_dropped);
+
+// Draws at most max_shown lines per frame (0 for no limit, the default), e.g. the terminal's
+// height less a margin, picking those ranked highest: by priority, then by how recently the
+// line or any of its descendants changed, counting progress, values and being added. A
+// picked line brings its ancestors along, within the limit, and lines keep their usual
+// order. Ranks are kept in a heap, at O(log n) per line change and at most once per line
+// per frame, so picking a frame's lines costs O(max_shown log max_shown) plus their depth,
+// however many lines there are. Lines hidden by a collapsed ancestor are never picked.
+void remp_set_line_limit(remp_ctx_t *ctx, uint16_t max_shown);
+
+// Lines rank above all lines of lower priority; 0 by default.
+void remp_set_priority(remp_ctx_t *ctx, int line_id, int32_t priority);
+
+// Records line adds + removes, named by each def's first label, and subtree progress
+// milestones into trace (see imptrace.h); NULL stops recording.
+void remp_set_trace(remp_ctx_t *ctx, struct imptrace *trace);
+
 void remp_draw_lines(remp_ctx_t *ctx, bool done);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
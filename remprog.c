@@ -1 +1,757 @@
 #include "improg/remprog.h"
+#include "improg/imptrace.h"
+
+#include <stddef.h>
+
+// Seat sections start REMP_SEAT_ALIGN-aligned, enough for the int64_t, double + pointer
+// members; REMP_SEAT_SIZE must sum the same sections remp_init carves out.
+#define REMP__ALIGN(X) REMP__SEAT_ALIGN_UP(X)
+
+_Static_assert(_Alignof(remp_ctx_t) <= REMP_SEAT_ALIGN, "seat under-aligned");
+_Static_assert(_Alignof(remp_line_t) <= REMP_SEAT_ALIGN, "seat under-aligned");
+_Static_assert(_Alignof(remp_scalar_t) <= REMP_SEAT_ALIGN, "seat under-aligned");
+_Static_assert(_Alignof(remp_ref_t) <= REMP_SEAT_ALIGN, "seat under-aligned");
+_Static_assert(!(sizeof(remp_scalar_t) % REMP_SEAT_ALIGN), "scalars end unaligned");
+_Static_assert(_Alignof(imp_value_t) <= REMP_SEAT_ALIGN, "seat under-aligned");
+
+// Budgeted bytes for a frame's own escapes: cursor + wrap modes, and the final erase.
+#define REMP__FRAME_OVERHEAD 32u
+
+static bool remp__valid_id(remp_ctx_t const *ctx, int line_id) {
+  return ctx && (line_id >= 0) && (line_id < (int)ctx->cfg.max_lines) &&
+    ctx->lines[line_id].w;
+}
+
+// Composites take a value per sub-widget, and stacked bars a count per segment.
+static bool remp__values_are_composite(imp_widget_def_t const *w) {
+  return (w->type == IMP_WIDGET_TYPE_COMPOSITE) || (w->type == IMP_WIDGET_TYPE_STACKED_BAR);
+}
+
+static int remp__value_count(imp_widget_def_t const *w) {
+  if (w->type == IMP_WIDGET_TYPE_STACKED_BAR) { return w->w.stacked_bar.segment_count; }
+  return (w->type == IMP_WIDGET_TYPE_COMPOSITE) ? w->w.composite.widget_count : 1;
+}
+
+static uint16_t *remp__first_child(remp_ctx_t *ctx, uint16_t parent) {
+  return (parent == REMP_NO_LINE) ? &ctx->first_root : &ctx->lines[parent].first_child;
+}
+
+static uint16_t *remp__last_child(remp_ctx_t *ctx, uint16_t parent) {
+  return (parent == REMP_NO_LINE) ? &ctx->last_root : &ctx->lines[parent].last_child;
+}
+
+// Scheduling rank: priority, then the last frame with activity. Live lines are stamped at
+// least once and frame_seq starts at 1, so only hidden lines rank INT64_MIN.
+static int64_t remp__rank(remp_ctx_t const *ctx, uint16_t li) {
+  if (ctx->lines[li].hidden) { return INT64_MIN; }
+  return ((int64_t)ctx->priority[li] * 4294967296) + (int64_t)ctx->act_seq[li];
+}
+
+static void remp__heap_set(remp_ctx_t *ctx, uint16_t i, uint16_t li) {
+  ctx->heap[i] = li;
+  ctx->heap_pos[li] = i;
+}
+
+static void remp__heap_up(remp_ctx_t *ctx, uint16_t i) {
+  uint16_t const li = ctx->heap[i];
+  int64_t const r = remp__rank(ctx, li);
+  while (i) {
+    uint16_t const up = (uint16_t)((i - 1u) / 2u);
+    if (remp__rank(ctx, ctx->heap[up]) >= r) { break; }
+    remp__heap_set(ctx, i, ctx->heap[up]);
+    i = up;
+  }
+  remp__heap_set(ctx, i, li);
+}
+
+static void remp__heap_down(remp_ctx_t *ctx, uint16_t i) {
+  uint16_t const li = ctx->heap[i];
+  int64_t const r = remp__rank(ctx, li);
+  for (;;) {
+    uint32_t c = (2u * i) + 1u;
+    if (c >= ctx->heap_len) { break; }
+    if (((c + 1u) < ctx->heap_len) &&
+        (remp__rank(ctx, ctx->heap[c + 1u]) > remp__rank(ctx, ctx->heap[c]))) {
+      ++c;
+    }
+    if (remp__rank(ctx, ctx->heap[c]) <= r) { break; }
+    remp__heap_set(ctx, i, ctx->heap[c]);
+    i = (uint16_t)c;
+  }
+  remp__heap_set(ctx, i, li);
+}
+
+// Restores li's heap position after its rank moved either way.
+static void remp__heap_fix(remp_ctx_t *ctx, uint16_t li) {
+  remp__heap_up(ctx, ctx->heap_pos[li]);
+  remp__heap_down(ctx, ctx->heap_pos[li]);
+}
+
+static void remp__heap_remove(remp_ctx_t *ctx, uint16_t li) {
+  uint16_t const last = ctx->heap[--ctx->heap_len];
+  if (last == li) { return; }
+  remp__heap_set(ctx, ctx->heap_pos[li], last);
+  remp__heap_fix(ctx, last);
+}
+
+// Stamps li and its ancestors as active this frame. A stamped line's ancestors are always
+// stamped too, so this stops at the first line already stamped.
+static void remp__touch(remp_ctx_t *ctx, uint16_t li) {
+  for (; li != REMP_NO_LINE; li = ctx->lines[li].parent) {
+    if (ctx->act_seq[li] == ctx->frame_seq) { return; }
+    ctx->act_seq[li] = ctx->frame_seq;
+    if (ctx->line_limit && !ctx->lines[li].hidden) { remp__heap_up(ctx, ctx->heap_pos[li]); }
+  }
+}
+
+static void remp__propagate(remp_ctx_t *ctx, uint16_t li, int64_t d_cur, int64_t d_max) {
+  remp__touch(ctx, li);
+  for (; li != REMP_NO_LINE; li = ctx->lines[li].parent) {
+    ctx->prog_cur[li] += d_cur;
+    ctx->prog_max[li] += d_max;
+    ctx->lines[li].dirty = true;
+    if (ctx->trace) {
+      imptrace_progress(ctx->trace, li, ctx->prog_cur[li] - d_cur, ctx->prog_max[li] - d_max,
+        ctx->prog_cur[li], ctx->prog_max[li]);
+    }
+  }
+}
+
+// A line's trace name is its def's first label.
+static char const *remp__trace_name(imp_widget_def_t const *w) {
+  if (w->type == IMP_WIDGET_TYPE_LABEL) { return w->w.label.s; }
+  if (w->type != IMP_WIDGET_TYPE_COMPOSITE) { return NULL; }
+  for (int i = 0; i < w->w.composite.widget_count; ++i) {
+    imp_widget_def_t const *sw = &w->w.composite.widgets[i];
+    if (sw->type == IMP_WIDGET_TYPE_LABEL) { return sw->w.label.s; }
+  }
+  return NULL;
+}
+
+static bool remp__store_value(remp_ctx_t *ctx, uint32_t vi, imp_value_t const *value) {
+  remp_scalar_t *sc = &ctx->scalars[vi];
+  remp_ref_t *r = &ctx->refs[vi];
+  switch (value->type) {
+    case IMP_VALUE_TYPE_NULL: break;
+    case IMP_VALUE_TYPE_INT: sc->i = value->v.i; break;
+#ifndef IMP_NO_DOUBLE
+    case IMP_VALUE_TYPE_DOUBLE: sc->d = value->v.d; break;
+#else
+    case IMP_VALUE_TYPE_DOUBLE: return false;
+#endif
+    case IMP_VALUE_TYPE_STRING: r->s = value->v.s; break;
+    case IMP_VALUE_TYPE_COMPOSITE: r->c = value->v.c; break;
+    case IMP_VALUE_TYPE_STRING_SPAN: r->sp = value->v.sp; break;
+    case IMP_VALUE_TYPE_HISTORY: r->h = value->v.h; break;
+    default: return false;
+  }
+  ctx->value_types[vi] = (uint8_t)value->type;
+  return true;
+}
+
+// Scratch rows are shared between lines, so the whole value is reset before it's filled in.
+static void remp__load_value(remp_ctx_t const *ctx, uint32_t vi, imp_value_t *out) {
+  *out = (imp_value_t){ .type = (imp_value_type_t)ctx->value_types[vi] };
+  switch (out->type) {
+    case IMP_VALUE_TYPE_INT: out->v.i = ctx->scalars[vi].i; break;
+#ifndef IMP_NO_DOUBLE
+    case IMP_VALUE_TYPE_DOUBLE: out->v.d = ctx->scalars[vi].d; break;
+#endif
+    case IMP_VALUE_TYPE_STRING: out->v.s = ctx->refs[vi].s; break;
+    case IMP_VALUE_TYPE_COMPOSITE: out->v.c = ctx->refs[vi].c; break;
+    case IMP_VALUE_TYPE_STRING_SPAN: out->v.sp = ctx->refs[vi].sp; break;
+    case IMP_VALUE_TYPE_HISTORY: out->v.h = ctx->refs[vi].h; break;
+#ifdef IMP_NO_DOUBLE
+    case IMP_VALUE_TYPE_DOUBLE:
+#endif
+    case IMP_VALUE_TYPE_NULL:
+    default: break;
+  }
+}
+
+// Lines that haven't been measured yet are assumed to be full-width 3-byte glyphs.
+static uint32_t remp__line_cost(remp_ctx_t const *ctx, uint16_t li, uint16_t tw) {
+  return ctx->line_bytes[li] ? ctx->line_bytes[li] : (((uint32_t)tw * 3u) + 16u);
+}
+
+// Pre-order successor of li's whole subtree.
+static uint16_t remp__next_after(remp_ctx_t const *ctx, uint16_t li) {
+  while ((li != REMP_NO_LINE) && (ctx->lines[li].next_sibling == REMP_NO_LINE)) {
+    li = ctx->lines[li].parent;
+  }
+  return (li == REMP_NO_LINE) ? REMP_NO_LINE : ctx->lines[li].next_sibling;
+}
+
+// Pre-order successor of li; skips the children of collapsed lines if skip_collapsed.
+static uint16_t remp__next(remp_ctx_t const *ctx, uint16_t li, bool skip_collapsed) {
+  remp_line_t const *l = &ctx->lines[li];
+  if ((l->first_child != REMP_NO_LINE) && !(skip_collapsed && l->collapsed)) {
+    return l->first_child;
+  }
+  return remp__next_after(ctx, li);
+}
+
+// Re-derives the hidden flags of li's descendants after li was collapsed or expanded.
+static void remp__update_hidden(remp_ctx_t *ctx, uint16_t li) {
+  uint16_t const end = remp__next_after(ctx, li);
+  uint16_t c = ctx->lines[li].first_child;
+  while ((c != REMP_NO_LINE) && (c != end)) {
+    remp_line_t *l = &ctx->lines[c];
+    remp_line_t const *p = &ctx->lines[l->parent];
+    bool const hidden = p->hidden || p->collapsed;
+    if (hidden == l->hidden) { c = remp__next_after(ctx, c); continue; } // subtree unchanged
+    l->hidden = hidden;
+    if (ctx->line_limit) { remp__heap_fix(ctx, c); }
+    c = remp__next(ctx, c, false);
+  }
+}
+
+static bool remp__visible(remp_ctx_t const *ctx, uint16_t li) {
+  for (li = ctx->lines[li].parent; li != REMP_NO_LINE; li = ctx->lines[li].parent) {
+    if (ctx->lines[li].collapsed) { return false; }
+  }
+  return true;
+}
+
+// Unlinks li and frees it with all of its descendants, leaving ancestors' totals alone.
+static void remp__free_subtree(remp_ctx_t *ctx, uint16_t li) {
+  remp_line_t *l = &ctx->lines[li];
+  ctx->redraw_all = true;
+
+  uint16_t *first = remp__first_child(ctx, l->parent), *last = remp__last_child(ctx, l->parent);
+  if (l->prev_sibling != REMP_NO_LINE) {
+    ctx->lines[l->prev_sibling].next_sibling = l->next_sibling;
+  } else {
+    *first = l->next_sibling;
+  }
+  if (l->next_sibling != REMP_NO_LINE) {
+    ctx->lines[l->next_sibling].prev_sibling = l->prev_sibling;
+  } else {
+    *last = l->prev_sibling;
+  }
+
+  // Detached, so a post-order walk from li frees exactly its subtree, each line after its
+  // children. Freeing relinks next_sibling, so it's read first.
+  l->parent = l->next_sibling = REMP_NO_LINE;
+  for (uint16_t cur = li; ; ) {
+    while (ctx->lines[cur].first_child != REMP_NO_LINE) { cur = ctx->lines[cur].first_child; }
+    remp_line_t *f = &ctx->lines[cur];
+    uint16_t const parent = f->parent, next = f->next_sibling;
+    if (ctx->trace) { imptrace_end(ctx->trace, cur, ctx->prog_cur[cur], ctx->prog_max[cur]); }
+    if (f->retiring) { --ctx->lines_retiring; }
+    if (ctx->line_limit) { remp__heap_remove(ctx, cur); }
+    f->w = NULL;
+    f->next_sibling = ctx->free_head;
+    ctx->free_head = cur;
+    --ctx->num_lines;
+    if (cur == li) { break; }
+    ctx->lines[parent].first_child = next;
+    cur = (next != REMP_NO_LINE) ? next : parent;
+  }
+}
+
+void remp_cfg(int max_lines,
+              int max_values_per_line,
+              int max_terminal_width,
+              remp_cfg_t *out_cfg) {
+  if (!out_cfg) { return; }
+  out_cfg->max_lines = (uint16_t)max_lines;
+  out_cfg->max_values_per_line = (uint16_t)max_values_per_line;
+  out_cfg->max_terminal_width = (uint16_t)max_terminal_width;
+  out_cfg->reqd_seat_size =
+    (uint32_t)REMP_SEAT_SIZE(max_lines, max_values_per_line, max_terminal_width);
+}
+
+void remp_init(remp_cfg_t const *cfg, void *seat, remp_ctx_t **out_ctx) {
+  if (!cfg || !seat || !out_ctx) { return; }
+  if ((uintptr_t)seat % REMP_SEAT_ALIGN) { *out_ctx = NULL; return; }
+  unsigned char *p = (unsigned char *)seat;
+  remp_ctx_t *ctx = (remp_ctx_t *)(void *)p;
+  p += REMP__ALIGN(sizeof(remp_ctx_t));
+  ctx->lines = (remp_line_t *)(void *)p;
+  p += REMP__ALIGN((size_t)cfg->max_lines * sizeof(remp_line_t));
+  int64_t *prog = (int64_t *)(void *)p;
+  ctx->own_cur = prog;
+  ctx->own_max = prog + cfg->max_lines;
+  ctx->prog_cur = prog + (2 * cfg->max_lines);
+  ctx->prog_max = prog + (3 * cfg->max_lines);
+  p += 4 * (size_t)cfg->max_lines * sizeof(int64_t);
+  size_t const value_count = (size_t)cfg->max_lines * cfg->max_values_per_line;
+  ctx->scalars = (remp_scalar_t *)(void *)p;
+  p += value_count * sizeof(remp_scalar_t);
+  ctx->refs = (remp_ref_t *)(void *)p;
+  p += value_count * sizeof(remp_ref_t);
+  ctx->value_types = (uint8_t *)p;
+  p += REMP__ALIGN(value_count * sizeof(uint8_t));
+  ctx->line_bytes = (uint16_t *)(void *)p;
+  p += REMP__ALIGN((size_t)cfg->max_lines * sizeof(uint16_t));
+  ctx->priority = (int32_t *)(void *)p;
+  ctx->act_seq = (uint32_t *)(void *)(p + ((size_t)cfg->max_lines * sizeof(uint32_t)));
+  ctx->add_seq = (uint32_t *)(void *)(p + (2 * (size_t)cfg->max_lines * sizeof(uint32_t)));
+  p += REMP__ALIGN(3 * (size_t)cfg->max_lines * sizeof(uint32_t));
+  uint16_t *sched = (uint16_t *)(void *)p;
+  ctx->heap = sched;
+  ctx->heap_pos = sched + cfg->max_lines;
+  ctx->frontier = sched + (2 * cfg->max_lines);
+  ctx->shown = sched + (3 * cfg->max_lines);
+  ctx->shown_next = sched + (4 * cfg->max_lines);
+  p += REMP__ALIGN(5 * (size_t)cfg->max_lines * sizeof(uint16_t));
+  ctx->scratch = (imp_value_t *)(void *)p;
+
+  ctx->cfg = *cfg;
+  imp_init(&ctx->imp, NULL, NULL);
+  ctx->num_lines = 0;
+  ctx->first_root = ctx->last_root = REMP_NO_LINE;
+  ctx->free_head = cfg->max_lines ? 0 : REMP_NO_LINE;
+  ctx->lines_retiring = 0;
+  ctx->last_terminal_width = 0;
+  ctx->frame_budget = 0;
+  ctx->frames_skipped = 0;
+  ctx->lines_deferred = 0;
+  ctx->drop_counter = NULL;
+  ctx->drops_seen = 0;
+  ctx->trace = NULL;
+  ctx->frame_seq = 1;
+  ctx->next_add_seq = 0;
+  ctx->line_limit = 0;
+  ctx->heap_len = 0;
+  ctx->shown_count = 0;
+  ctx->scheduled = false;
+  ctx->redraw_all = true;
+  for (unsigned i = 0; i < cfg->max_lines; ++i) {
+    ctx->lines[i] = (remp_line_t){ .w = NULL,
+      .next_sibling = (i + 1u < cfg->max_lines) ? (uint16_t)(i + 1u) : REMP_NO_LINE };
+  }
+  *out_ctx = ctx;
+}
+
+void remp_add_child_line(remp_ctx_t *ctx,
+                         int parent_line_id,
+                         imp_widget_def_t const *def,
+                         int *out_line_id) {
+  if (out_line_id) { *out_line_id = -1; }
+  if (!ctx || !def || (ctx->free_head == REMP_NO_LINE)) { return; }
+  if ((parent_line_id != -1) && !remp__valid_id(ctx, parent_line_id)) { return; }
+  int const value_count = remp__value_count(def);
+  if ((value_count < 0) || (value_count > (int)ctx->cfg.max_values_per_line)) { return; }
+  int depth; // checked once here, so drawing can skip the per-line walk
+  if (imp_widget_depth(def, &depth) != IMP_RET_SUCCESS) { return; }
+
+  uint16_t const li = ctx->free_head;
+  uint16_t const parent = (parent_line_id == -1) ? REMP_NO_LINE : (uint16_t)parent_line_id;
+  remp_line_t *l = &ctx->lines[li];
+  ctx->free_head = l->next_sibling;
+
+  uint16_t *first = remp__first_child(ctx, parent), *last = remp__last_child(ctx, parent);
+  remp_line_t const *p = (parent == REMP_NO_LINE) ? NULL : &ctx->lines[parent];
+
+  *l = (remp_line_t){ .w = def,
+                      .value_start_idx = (uint32_t)li * ctx->cfg.max_values_per_line,
+                      .parent = parent,
+                      .first_child = REMP_NO_LINE,
+                      .last_child = REMP_NO_LINE,
+                      .prev_sibling = *last,
+                      .next_sibling = REMP_NO_LINE,
+                      .depth = p ? (uint16_t)(p->depth + 1u) : 0,
+                      .hidden = p && (p->hidden || p->collapsed) };
+  if (*last != REMP_NO_LINE) { ctx->lines[*last].next_sibling = li; } else { *first = li; }
+  *last = li;
+
+  ctx->own_cur[li] = ctx->own_max[li] = ctx->prog_cur[li] = ctx->prog_max[li] = 0;
+  ctx->line_bytes[li] = 0;
+  for (int i = 0; i < value_count; ++i) {
+    ctx->value_types[l->value_start_idx + (uint32_t)i] = (uint8_t)IMP_VALUE_TYPE_NULL;
+  }
+
+  ctx->priority[li] = 0;
+  ctx->act_seq[li] = 0;
+  ctx->add_seq[li] = ctx->next_add_seq++;
+  if (ctx->line_limit) { remp__heap_set(ctx, ctx->heap_len, li); ++ctx->heap_len; }
+  remp__touch(ctx, li);
+
+  ++ctx->num_lines;
+  ctx->redraw_all = true;
+  if (ctx->trace) { imptrace_begin(ctx->trace, li, parent, remp__trace_name(def)); }
+  if (out_line_id) { *out_line_id = li; }
+}
+
+void remp_add_line(remp_ctx_t *ctx, imp_widget_def_t const *def, int *out_line_id) {
+  remp_add_child_line(ctx, -1, def, out_line_id);
+}
+
+void remp_remove_line(remp_ctx_t *ctx, int line_id) {
+  if (!remp__valid_id(ctx, line_id)) { return; }
+  uint16_t const li = (uint16_t)line_id;
+  remp__propagate(ctx, ctx->lines[li].parent, -ctx->prog_cur[li], -ctx->prog_max[li]);
+  remp__free_subtree(ctx, li);
+}
+
+void remp_retire_line(remp_ctx_t *ctx, int line_id) {
+  if (!remp__valid_id(ctx, line_id) || ctx->lines[line_id].retiring) { return; }
+  ctx->lines[line_id].retiring = true;
+  ++ctx->lines_retiring;
+  ctx->redraw_all = true;
+}
+
+void remp_set_value(remp_ctx_t *ctx, int line_id, int value_idx, imp_value_t const *value) {
+  if (!remp__valid_id(ctx, line_id) || !value) { return; }
+  remp_line_t const *l = &ctx->lines[line_id];
+  if ((value_idx < 0) || (value_idx >= remp__value_count(l->w))) { return; }
+  if (remp__store_value(ctx, l->value_start_idx + (uint32_t)value_idx, value)) {
+    ctx->lines[line_id].dirty = true;
+    remp__touch(ctx, (uint16_t)line_id);
+  }
+}
+
+void remp_set_int_values(remp_ctx_t *ctx,
+                         int value_idx,
+                         int count,
+                         int const *line_ids,
+                         int64_t const *values) {
+  if (!ctx || !line_ids || !values || (value_idx < 0)) { return; }
+  for (int i = 0; i < count; ++i) {
+    if (!remp__valid_id(ctx, line_ids[i])) { continue; }
+    remp_line_t *l = &ctx->lines[line_ids[i]];
+    if (value_idx >= remp__value_count(l->w)) { continue; }
+    uint32_t const vi = l->value_start_idx + (uint32_t)value_idx;
+    ctx->scalars[vi].i = values[i];
+    ctx->value_types[vi] = (uint8_t)IMP_VALUE_TYPE_INT;
+    l->dirty = true;
+    remp__touch(ctx, (uint16_t)line_ids[i]);
+  }
+}
+
+void remp_set_progress(remp_ctx_t *ctx, int line_id, int64_t cur, int64_t max) {
+  if (!remp__valid_id(ctx, line_id)) { return; }
+  int64_t const d_cur = cur - ctx->own_cur[line_id], d_max = max - ctx->own_max[line_id];
+  ctx->own_cur[line_id] = cur;
+  ctx->own_max[line_id] = max;
+  remp__propagate(ctx, (uint16_t)line_id, d_cur, d_max);
+}
+
+void remp_set_progress_n(remp_ctx_t *ctx,
+                         int count,
+                         int const *line_ids,
+                         int64_t const *curs,
+                         int64_t const *maxs) {
+  if (!ctx || !line_ids || !curs || !maxs) { return; }
+  for (int i = 0; i < count; ++i) { remp_set_progress(ctx, line_ids[i], curs[i], maxs[i]); }
+}
+
+void remp_add_progress(remp_ctx_t *ctx, int line_id, int64_t cur_delta) {
+  if (!remp__valid_id(ctx, line_id)) { return; }
+  ctx->own_cur[line_id] += cur_delta;
+  remp__propagate(ctx, (uint16_t)line_id, cur_delta, 0);
+}
+
+void remp_set_collapsed(remp_ctx_t *ctx, int line_id, bool collapsed) {
+  if (!remp__valid_id(ctx, line_id)) { return; }
+  remp_line_t *l = &ctx->lines[line_id];
+  if (l->collapsed == collapsed) { return; }
+  l->collapsed = collapsed;
+  if (l->first_child != REMP_NO_LINE) {
+    ctx->redraw_all = true;
+    remp__update_hidden(ctx, (uint16_t)line_id);
+  }
+}
+
+void remp_set_low_priority(remp_ctx_t *ctx, int line_id, bool low_priority) {
+  if (!remp__valid_id(ctx, line_id)) { return; }
+  ctx->lines[line_id].low_priority = low_priority;
+}
+
+void remp_set_frame_budget(remp_ctx_t *ctx, uint32_t bytes) {
+  if (ctx) { ctx->frame_budget = bytes; }
+}
+
+void remp_set_drop_counter(remp_ctx_t *ctx, uint64_t const *frames_dropped) {
+  if (!ctx) { return; }
+  ctx->drop_counter = frames_dropped;
+  ctx->drops_seen = frames_dropped ? *frames_dropped : 0;
+}
+
+void remp_set_line_limit(remp_ctx_t *ctx, uint16_t max_shown) {
+  if (!ctx || (max_shown == ctx->line_limit)) { return; }
+  if (!ctx->line_limit) { // the heap isn't kept without a limit, so build it afresh
+    ctx->heap_len = 0;
+    for (uint16_t li = 0; li < ctx->cfg.max_lines; ++li) {
+      if (ctx->lines[li].w) { remp__heap_set(ctx, ctx->heap_len, li); ++ctx->heap_len; }
+    }
+    for (uint16_t i = ctx->heap_len / 2u; i-- > 0; ) { remp__heap_down(ctx, i); }
+  }
+  ctx->line_limit = max_shown;
+}
+
+void remp_set_priority(remp_ctx_t *ctx, int line_id, int32_t priority) {
+  if (!remp__valid_id(ctx, line_id)) { return; }
+  ctx->priority[line_id] = priority;
+  if (ctx->line_limit) { remp__heap_fix(ctx, (uint16_t)line_id); }
+}
+
+void remp_set_trace(remp_ctx_t *ctx, struct imptrace *trace) {
+  if (ctx) { ctx->trace = trace; }
+}
+
+static void remp__frontier_push(remp_ctx_t *ctx, uint16_t *n, uint16_t hi) {
+  int64_t const r = remp__rank(ctx, ctx->heap[hi]);
+  uint16_t i = (*n)++;
+  while (i) {
+    uint16_t const up = (uint16_t)((i - 1u) / 2u);
+    if (remp__rank(ctx, ctx->heap[ctx->frontier[up]]) >= r) { break; }
+    ctx->frontier[i] = ctx->frontier[up];
+    i = up;
+  }
+  ctx->frontier[i] = hi;
+}
+
+static uint16_t remp__frontier_pop(remp_ctx_t *ctx, uint16_t *n) {
+  uint16_t const top = ctx->frontier[0], hi = ctx->frontier[--*n];
+  int64_t const r = remp__rank(ctx, ctx->heap[hi]);
+  uint16_t i = 0;
+  for (;;) {
+    uint32_t c = (2u * i) + 1u;
+    if (c >= *n) { break; }
+    if (((c + 1u) < *n) && (remp__rank(ctx, ctx->heap[ctx->frontier[c + 1u]]) >
+                            remp__rank(ctx, ctx->heap[ctx->frontier[c]]))) {
+      ++c;
+    }
+    if (remp__rank(ctx, ctx->heap[ctx->frontier[c]]) <= r) { break; }
+    ctx->frontier[i] = ctx->frontier[c];
+    i = (uint16_t)c;
+  }
+  ctx->frontier[i] = hi;
+  return top;
+}
+
+// Whether a is drawn before b: pre-order, with siblings in the order they were added.
+static bool remp__before(remp_ctx_t const *ctx, uint16_t a, uint16_t b) {
+  remp_line_t const *l = ctx->lines;
+  if (a == b) { return false; }
+  while (l[a].depth > l[b].depth) {
+    a = l[a].parent;
+    if (a == b) { return false; }
+  }
+  while (l[b].depth > l[a].depth) {
+    b = l[b].parent;
+    if (b == a) { return true; }
+  }
+  while (l[a].parent != l[b].parent) { a = l[a].parent; b = l[b].parent; }
+  return (int32_t)(ctx->add_seq[a] - ctx->add_seq[b]) < 0;
+}
+
+static void remp__order_down(remp_ctx_t const *ctx, uint16_t *ids, uint16_t i, uint16_t n) {
+  uint16_t const li = ids[i];
+  for (;;) {
+    uint32_t c = (2u * i) + 1u;
+    if (c >= n) { break; }
+    if (((c + 1u) < n) && remp__before(ctx, ids[c], ids[c + 1u])) { ++c; }
+    if (!remp__before(ctx, li, ids[c])) { break; }
+    ids[i] = ids[c];
+    i = (uint16_t)c;
+  }
+  ids[i] = li;
+}
+
+// Picks the frame's lines into shown, best ranked first, by walking the heap's top through
+// a frontier of candidate heap slots, then heap-sorts them into draw order. A line comes
+// with its unpicked ancestors, and picking stops at the first that doesn't fit. Lines being
+// retired are drawn separately, so neither they nor their descendants are picked.
+static void remp__schedule(remp_ctx_t *ctx) {
+  uint16_t *ids = ctx->shown_next, n = 0, fn = 0;
+  if (ctx->heap_len) { remp__frontier_push(ctx, &fn, 0); }
+  while (fn && (n < ctx->line_limit)) {
+    uint16_t const hi = remp__frontier_pop(ctx, &fn), li = ctx->heap[hi];
+    if (ctx->lines[li].hidden) { break; } // hidden lines rank last, so the rest are too
+    for (uint32_t c = (2u * hi) + 1u; (c < ctx->heap_len) && (c <= (2u * hi) + 2u); ++c) {
+      remp__frontier_push(ctx, &fn, (uint16_t)c);
+    }
+    uint16_t need = 0, a = li;
+    bool retiring = false;
+    for (; (a != REMP_NO_LINE) && !ctx->lines[a].selected; a = ctx->lines[a].parent) {
+      ++need;
+      retiring = retiring || ctx->lines[a].retiring;
+    }
+    if (retiring) { continue; }
+    if (need > (ctx->line_limit - n)) { break; }
+    for (a = li; (a != REMP_NO_LINE) && !ctx->lines[a].selected; a = ctx->lines[a].parent) {
+      ctx->lines[a].selected = true;
+      ids[n++] = a;
+    }
+  }
+
+  for (uint16_t i = n / 2u; i-- > 0; ) { remp__order_down(ctx, ids, i, n); }
+  for (uint16_t end = n; end > 1; ) {
+    --end;
+    uint16_t const t = ids[0];
+    ids[0] = ids[end];
+    ids[end] = t;
+    remp__order_down(ctx, ids, 0, end);
+  }
+
+  bool changed = !ctx->scheduled || (n != ctx->shown_count);
+  for (uint16_t i = 0; i < n; ++i) {
+    ctx->lines[ids[i]].selected = false;
+    changed = changed || (ids[i] != ctx->shown[i]);
+  }
+  ctx->shown_next = ctx->shown;
+  ctx->shown = ids;
+  ctx->shown_count = n;
+  ctx->scheduled = true;
+  if (changed) { ctx->redraw_all = true; }
+}
+
+// Walks a frame's lines from li (REMP_NO_LINE to start): the scheduled ones if the last
+// remp__schedule applies, or every visible line otherwise.
+static uint16_t remp__frame_next(remp_ctx_t const *ctx, uint16_t li, uint16_t *io_idx) {
+  if (ctx->scheduled) {
+    return (*io_idx < ctx->shown_count) ? ctx->shown[(*io_idx)++] : REMP_NO_LINE;
+  }
+  li = (li == REMP_NO_LINE) ? ctx->first_root : remp__next(ctx, li, true);
+  // Retiring subtrees are drawn apart from the frame, by remp__draw_retiring.
+  while (ctx->lines_retiring && (li != REMP_NO_LINE) && ctx->lines[li].retiring) {
+    li = remp__next_after(ctx, li);
+  }
+  return li;
+}
+
+static void remp__draw_line(remp_ctx_t *ctx, uint16_t li) {
+  remp_line_t *l = &ctx->lines[li];
+  l->dirty = false;
+  uint32_t const bytes_before = ctx->imp.frame_bytes;
+  imp_value_t const cur = IMP_VALUE_INT(ctx->prog_cur[li]);
+  imp_value_t const max = IMP_VALUE_INT(ctx->prog_max[li]);
+  bool const has_prog = (ctx->prog_max[li] != 0); // else it'd draw as 0/0, i.e. complete
+  int const value_count = remp__value_count(l->w);
+  imp_value_t *v = ctx->scratch;
+  for (int i = 0; i < value_count; ++i) {
+    remp__load_value(ctx, l->value_start_idx + (uint32_t)i, &v[i]);
+  }
+  imp_value_t const cv = { .type = IMP_VALUE_TYPE_COMPOSITE, .v = { .c = {
+    .values = v, .value_count = (int16_t)value_count } } };
+  ctx->imp.trusted_depth = true;
+  imp_draw_line(&ctx->imp, has_prog ? &cur : NULL, has_prog ? &max : NULL, l->w,
+                remp__values_are_composite(l->w) ? &cv : v);
+  ctx->imp.trusted_depth = false;
+  uint32_t const cost = ctx->imp.frame_bytes - bytes_before;
+  ctx->line_bytes[li] = (uint16_t)((cost < UINT16_MAX) ? cost : UINT16_MAX);
+}
+
+// The first retiring line at or after li in pre-order; its subtree retires with it.
+static uint16_t remp__next_retiring(remp_ctx_t const *ctx, uint16_t li) {
+  while ((li != REMP_NO_LINE) && !ctx->lines[li].retiring) { li = remp__next(ctx, li, false); }
+  return li;
+}
+
+// Draws the visible retiring subtrees at the top of the frame, in pre-order, and leaves them
+// behind as scrollback. They're only freed once the frame is known to have been delivered.
+static void remp__draw_retiring(remp_ctx_t *ctx) {
+  for (uint16_t li = remp__next_retiring(ctx, ctx->first_root); li != REMP_NO_LINE;
+       li = remp__next_retiring(ctx, remp__next_after(ctx, li))) {
+    if (!remp__visible(ctx, li)) { continue; }
+    uint16_t const end = remp__next_after(ctx, li);
+    for (uint16_t c = li; c != end; c = remp__next(ctx, c, true)) { remp__draw_line(ctx, c); }
+  }
+  imp_retire_lines(&ctx->imp);
+  ctx->redraw_all = true; // everything below moved up
+}
+
+static uint32_t remp__retiring_cost(remp_ctx_t const *ctx, uint16_t tw) {
+  uint32_t cost = 0;
+  for (uint16_t li = remp__next_retiring(ctx, ctx->first_root); li != REMP_NO_LINE;
+       li = remp__next_retiring(ctx, remp__next_after(ctx, li))) {
+    if (!remp__visible(ctx, li)) { continue; }
+    uint16_t const end = remp__next_after(ctx, li);
+    for (uint16_t c = li; c != end; c = remp__next(ctx, c, true)) {
+      cost += remp__line_cost(ctx, c, tw);
+    }
+  }
+  return cost;
+}
+
+// Frees the retiring subtrees once their frame was delivered. They're already scrollback,
+// so nothing on screen moves.
+static void remp__free_retiring(remp_ctx_t *ctx) {
+  bool const redraw_all = ctx->redraw_all;
+  for (uint16_t li = remp__next_retiring(ctx, ctx->first_root); li != REMP_NO_LINE; ) {
+    uint16_t const next = remp__next_retiring(ctx, remp__next_after(ctx, li));
+    remp__free_subtree(ctx, li);
+    li = next;
+  }
+  ctx->redraw_all = redraw_all;
+}
+
+// True once per change of the watched drop counter: the write sink dropped a frame.
+static bool remp__frame_dropped(remp_ctx_t *ctx) {
+  if (!ctx->drop_counter || (*ctx->drop_counter == ctx->drops_seen)) { return false; }
+  ctx->drops_seen = *ctx->drop_counter;
+  return true;
+}
+
+void remp_draw_lines(remp_ctx_t *ctx, bool done) {
+  if (!ctx) { return; }
+  if (remp__frame_dropped(ctx)) {
+    imp_resync(&ctx->imp);
+    ctx->redraw_all = true;
+  }
+  uint16_t tw = ctx->cfg.max_terminal_width;
+  if (imp_util_get_terminal_width(&tw) && (tw > ctx->cfg.max_terminal_width)) {
+    tw = ctx->cfg.max_terminal_width;
+  }
+
+  if (tw != ctx->last_terminal_width) { ctx->redraw_all = true; }
+  ctx->last_terminal_width = tw;
+
+  if (ctx->line_limit && (ctx->num_lines > ctx->line_limit)) {
+    remp__schedule(ctx);
+  } else if (ctx->scheduled) {
+    ctx->scheduled = false;
+    ctx->redraw_all = true;
+  }
+
+  // Lines that have to be drawn (all of them, on a full redraw) are reserved first; changed
+  // low-priority lines share what's left, top to bottom.
+  uint32_t spare = UINT32_MAX;
+  if (ctx->frame_budget && !done) {
+    uint32_t need = REMP__FRAME_OVERHEAD;
+    if (ctx->lines_retiring) { need += remp__retiring_cost(ctx, tw); }
+    uint16_t idx = 0;
+    for (uint16_t li = remp__frame_next(ctx, REMP_NO_LINE, &idx); li != REMP_NO_LINE;
+         li = remp__frame_next(ctx, li, &idx)) {
+      remp_line_t const *l = &ctx->lines[li];
+      if (ctx->redraw_all || (l->dirty && !l->low_priority)) {
+        need += remp__line_cost(ctx, li, tw);
+      }
+    }
+    if (need > ctx->frame_budget) { ++ctx->frames_skipped; return; }
+    spare = ctx->frame_budget - need;
+  }
+
+  imp_begin(&ctx->imp, tw);
+  if (ctx->lines_retiring) { remp__draw_retiring(ctx); }
+  uint16_t idx = 0;
+  for (uint16_t li = remp__frame_next(ctx, REMP_NO_LINE, &idx); li != REMP_NO_LINE;
+       li = remp__frame_next(ctx, li, &idx)) {
+    remp_line_t *l = &ctx->lines[li];
+    bool draw = l->dirty || ctx->redraw_all;
+    if (draw && !ctx->redraw_all && l->low_priority) {
+      uint32_t const cost = remp__line_cost(ctx, li, tw);
+      draw = (cost <= spare);
+      if (draw) { spare -= cost; }
+    }
+    if (!draw && (imp_skip_line(&ctx->imp) == IMP_RET_SUCCESS)) {
+      if (l->dirty) { ++ctx->lines_deferred; }
+      continue;
+    }
+    remp__draw_line(ctx, li);
+  }
+  imp_end(&ctx->imp, done);
+  if (remp__frame_dropped(ctx)) {
+    // Nothing reached the screen: retiring lines stay, to be drawn + retired again.
+    imp_resync(&ctx->imp);
+    ctx->redraw_all = true;
+  } else {
+    ctx->redraw_all = done; // a finished frame scrolls away; the next starts from scratch
+    if (ctx->lines_retiring) { remp__free_retiring(ctx); }
+  }
+  if (!++ctx->frame_seq) { ctx->frame_seq = 1; }
+}